@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -7,14 +8,691 @@
 #include<fcntl.h>
 #include<ctype.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <limits.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
 
 // I have taken maximum command length as 100 which can be modified
 #define MAX_COMMAND_LENGTH 100
-// I have taken maximum processes that can be pushed to background to be 100 which can modified
-// Array to store background process IDs
-int background_processes[100];
-// Counter to keep track of number of processes in background
-int background_process_count = 0;
+// Exit status of the last command the shell waited for
+int last_exit_status = 0;
+// Exit status of a command that could not be executed
+#define EXIT_COMMAND_NOT_FOUND 127
+
+// Options changed with the set builtin
+// set -e: stop running commands at the first failure
+int errexit_enabled = 0;
+// set -o pipefail: a pipeline fails if any of its commands fails
+int pipefail_enabled = 0;
+// Set when the last failure was in a && or || list before its last command,
+// which set -e does not stop for
+int errexit_ignored = 0;
+
+// Function to check whether set -e should stop the shell after the last command
+// Returns:
+//  1 if set -e is on and the last command failed outside a condition, else 0
+int failureStopsShell() {
+    return errexit_enabled && last_exit_status != 0 && !errexit_ignored;
+}
+
+// Function to turn a status from waitpid into a shell exit status
+// Parameters:
+// - status: Status filled in by waitpid
+// Returns:
+//  The exit code for commands that exited, 128 + signal number for killed ones
+int decodeWaitStatus(int status) {
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+// Largest RSS in KB of the foreground processes reaped since it was last reset
+long foreground_max_rss_kb = 0;
+
+// Function to wait for a foreground process and note its peak memory use
+// Parameters:
+// - pid, status, options: Same as waitpid
+// Returns:
+//  Same as waitpid
+pid_t waitForegroundProcess(pid_t pid, int *status, int options) {
+    struct rusage usage;
+    pid_t result = wait4(pid, status, options, &usage);
+    if (result > 0 && usage.ru_maxrss > foreground_max_rss_kb) {
+        foreground_max_rss_kb = usage.ru_maxrss;
+    }
+    return result;
+}
+
+// Function to end a forked child that did not exec
+// exit() would also close the shell's stdio streams, and closing an input
+// stream seeks its file back to where the shell had read up to. A script on
+// stdin or a sourced file shares that offset with the shell, which would then
+// read the same lines again.
+// Parameters:
+// - status: Exit status of the child
+void exitChild(int status) {
+    fflush(stdout);
+    fflush(stderr);
+    _exit(status);
+}
+
+// Function to get the current time of the monotonic clock in microseconds
+long long monotonicMicroseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// I have taken maximum jobs (background or stopped) the shell keeps track of to be 100 which can be modified
+#define MAX_JOBS 100
+// Maximum number of processes in one job, enough for a full pipeline with fan-out helpers
+#define MAX_JOB_PROCESSES 16
+
+// States of a process or a job
+enum JobState { JOB_RUNNING, JOB_STOPPED, JOB_DONE };
+
+// A process belonging to a job
+struct JobProcess {
+    pid_t pid;
+    int state;
+    int status;     // Exit status once the process is done
+    int helper;     // Shell helper such as a fan-out, never the job's status
+};
+
+// A job is a command line whose processes share one process group
+struct Job {
+    int id;                 // Job number used as %n, 0 when the slot is free
+    pid_t pgid;
+    struct JobProcess processes[MAX_JOB_PROCESSES];
+    int numProcesses;
+    int statusIndex;        // Process whose exit status is the job's status
+    int state;
+    int foreground;
+    long sequence;          // Orders jobs by when they were last started or stopped
+    long long startTime;    // Monotonic time the job was created, in microseconds
+    char command[MAX_COMMAND_LENGTH];
+    struct termios terminalModes;   // Saved when stopped in the foreground, the shell's modes until then
+};
+
+// Table of jobs, job %n lives in jobs[n - 1]
+struct Job jobs[MAX_JOBS];
+long job_sequence = 0;
+// Command line being processed, used to name new jobs
+char current_command_line[MAX_COMMAND_LENGTH] = "";
+
+// Job control is only enabled when the shell runs on a terminal
+int job_control_enabled = 0;
+int shell_terminal = STDIN_FILENO;
+pid_t shell_pgid;
+struct termios shell_terminal_modes;
+
+// Function to enable job control when the shell is interactive
+// The shell waits until it is in the foreground, puts itself in its own
+// process group, takes the terminal and ignores the job control signals
+// so that Ctrl-C and Ctrl-Z only reach the foreground job.
+void initJobControl() {
+    if (!isatty(shell_terminal)) {
+        return;
+    }
+
+    // Stop ourselves until we are in the foreground
+    while (tcgetpgrp(shell_terminal) != (shell_pgid = getpgrp())) {
+        kill(-shell_pgid, SIGTTIN);
+    }
+
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    shell_pgid = getpid();
+    if (getpgrp() != shell_pgid && setpgid(shell_pgid, shell_pgid) == -1) {
+        perror("Couldn't put the shell in its own process group");
+        exit(1);
+    }
+    tcsetpgrp(shell_terminal, shell_pgid);
+    tcgetattr(shell_terminal, &shell_terminal_modes);
+    job_control_enabled = 1;
+}
+
+// Function to restore the default signal handling in a forked child
+// Ignored signals survive exec, so children must undo what initJobControl did.
+void resetChildSignals() {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+}
+
+// Function to create a job for the command line being processed
+// Parameters:
+// - foreground: 1 if the shell waits for the job, 0 for a background job
+// Returns:
+//  The new job, NULL if the job table is full
+struct Job *createJob(int foreground) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id == 0) {
+            struct Job *job = &jobs[i];
+            memset(job, 0, sizeof(*job));
+            job->id = i + 1;
+            job->state = JOB_RUNNING;
+            job->foreground = foreground;
+            job->sequence = ++job_sequence;
+            job->startTime = monotonicMicroseconds();
+            job->statusIndex = -1;
+            // A job stopped in the background never had its own modes saved
+            job->terminalModes = shell_terminal_modes;
+            snprintf(job->command, sizeof(job->command), "%s", current_command_line);
+            return job;
+        }
+    }
+    printf("Error: Too many jobs (up to %d allowed)\n", MAX_JOBS);
+    last_exit_status = 1;
+    return NULL;
+}
+
+// Function to release a job's slot in the job table
+void freeJob(struct Job *job) {
+    job->id = 0;
+}
+
+// Function to fork a process that belongs to a job
+// Both the parent and the child put the child in the job's process group
+// to avoid racing each other; the first process of a job leads the group.
+// A foreground child also takes the terminal before it runs.
+// Parameters:
+// - job: The job, NULL for a process outside job control
+// Returns:
+//  Same as fork
+// Example:
+//   int pid = forkJobProcess(job);
+pid_t forkJobProcess(struct Job *job) {
+    if (job != NULL && job->numProcesses == MAX_JOB_PROCESSES) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    // Flush so the child does not repeat buffered output when it exits
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (job != NULL && job_control_enabled) {
+            pid_t pgid = job->pgid ? job->pgid : getpid();
+            setpgid(0, pgid);
+            if (job->foreground) {
+                tcsetpgrp(shell_terminal, pgid);
+            }
+        }
+        resetChildSignals();
+        // The child is not in charge of any job
+        job_control_enabled = 0;
+    } else if (pid > 0 && job != NULL) {
+        if (job->pgid == 0) {
+            job->pgid = pid;
+        }
+        if (job_control_enabled) {
+            setpgid(pid, job->pgid);
+        }
+        struct JobProcess *process = &job->processes[job->numProcesses++];
+        process->pid = pid;
+        process->state = JOB_RUNNING;
+        process->status = 0;
+        job->statusIndex = job->numProcesses - 1;
+    }
+    return pid;
+}
+
+// Function to send a signal to every process of a job
+void signalJob(struct Job *job, int signalNumber) {
+    if (job_control_enabled) {
+        kill(-job->pgid, signalNumber);
+        return;
+    }
+    for (int i = 0; i < job->numProcesses; i++) {
+        if (job->processes[i].state != JOB_DONE) {
+            kill(job->processes[i].pid, signalNumber);
+        }
+    }
+}
+
+// Function to record a status reported by waitpid for one of a job's processes
+// Returns:
+//  1 if the pid belongs to the job, 0 otherwise
+int updateJobProcess(struct Job *job, pid_t pid, int status) {
+    for (int i = 0; i < job->numProcesses; i++) {
+        struct JobProcess *process = &job->processes[i];
+        if (process->pid != pid) {
+            continue;
+        }
+        if (WIFSTOPPED(status)) {
+            process->state = JOB_STOPPED;
+        } else if (WIFCONTINUED(status)) {
+            process->state = JOB_RUNNING;
+        } else {
+            process->state = JOB_DONE;
+            process->status = decodeWaitStatus(status);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// Function to work out a job's state from the states of its processes
+// A job is done when all its processes are done and stopped when any
+// process that is still alive is stopped.
+void refreshJobState(struct Job *job) {
+    int alive = 0;
+    int stopped = 0;
+    for (int i = 0; i < job->numProcesses; i++) {
+        if (job->processes[i].state != JOB_DONE) {
+            alive++;
+        }
+        if (job->processes[i].state == JOB_STOPPED) {
+            stopped++;
+        }
+    }
+    if (alive == 0) {
+        job->state = JOB_DONE;
+    } else if (stopped > 0) {
+        job->state = JOB_STOPPED;
+    } else {
+        job->state = JOB_RUNNING;
+    }
+}
+
+// Function to get the exit status of a job
+// With set -o pipefail it is the status of the last command that failed,
+// so that "false | cat" fails, and otherwise the status of the last command.
+// Returns:
+//  Exit status of the job, 128 + SIGTSTP if the job is stopped
+int jobExitStatus(struct Job *job) {
+    if (job->state == JOB_STOPPED) {
+        return 128 + SIGTSTP;
+    }
+    if (job->statusIndex < 0) {
+        return 0;
+    }
+    if (pipefail_enabled) {
+        for (int i = job->statusIndex; i >= 0; i--) {
+            if (!job->processes[i].helper && job->processes[i].status != 0) {
+                return job->processes[i].status;
+            }
+        }
+    }
+    return job->processes[job->statusIndex].status;
+}
+
+// Function to print a job the way the jobs builtin lists it
+void printJob(struct Job *job) {
+    const char *stateNames[] = {"Running", "Stopped", "Done"};
+    printf("[%d] %-8s %s\n", job->id, stateNames[job->state], job->command);
+}
+
+// Function to wait for a foreground job, giving it the terminal meanwhile
+// Returns once every process has exited or the job has been stopped with
+// Ctrl-Z; a stopped job stays in the job table and can be resumed with fg/bg.
+// Parameters:
+// - job: The job, NULL if it could not be created
+// Returns:
+//  Exit status of the job
+// Example:
+//   int status = waitForegroundJob(job);
+int waitForegroundJob(struct Job *job) {
+    if (job == NULL) {
+        return 1;
+    }
+    job->foreground = 1;
+    if (job_control_enabled) {
+        tcsetpgrp(shell_terminal, job->pgid);
+    }
+
+    refreshJobState(job);
+    while (job->state == JOB_RUNNING) {
+        // Without job control the processes are waited for one by one
+        pid_t waitFor = -job->pgid;
+        if (!job_control_enabled) {
+            for (int i = 0; i < job->numProcesses; i++) {
+                if (job->processes[i].state != JOB_DONE) {
+                    waitFor = job->processes[i].pid;
+                    break;
+                }
+            }
+        }
+
+        int status;
+        pid_t pid = waitForegroundProcess(waitFor, &status, WUNTRACED);
+        if (pid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Nothing left to wait for, treat the remaining processes as done
+            for (int i = 0; i < job->numProcesses; i++) {
+                job->processes[i].state = JOB_DONE;
+            }
+            break;
+        }
+        if (updateJobProcess(job, pid, status) == 0) {
+            // A background job finished while we were waiting
+            for (int i = 0; i < MAX_JOBS; i++) {
+                if (jobs[i].id != 0 && updateJobProcess(&jobs[i], pid, status)) {
+                    refreshJobState(&jobs[i]);
+                    break;
+                }
+            }
+        }
+        refreshJobState(job);
+    }
+
+    // Take the terminal back
+    if (job_control_enabled) {
+        tcsetpgrp(shell_terminal, shell_pgid);
+        if (job->state == JOB_STOPPED) {
+            tcgetattr(shell_terminal, &job->terminalModes);
+        }
+        tcsetattr(shell_terminal, TCSADRAIN, &shell_terminal_modes);
+    }
+
+    int exitStatus = jobExitStatus(job);
+    job->foreground = 0;
+    // Keep the prompt off the line where ^C was echoed
+    if (job_control_enabled && exitStatus == 128 + SIGINT) {
+        printf("\n");
+    }
+    if (job->state == JOB_STOPPED) {
+        job->sequence = ++job_sequence;
+        printf("\n");
+        printJob(job);
+    } else {
+        freeJob(job);
+    }
+    return exitStatus;
+}
+
+// Maximum number of helper processes left running by background command lines
+#define MAX_DETACHED_PROCESSES 64
+
+// Helper processes that are not part of a job and that the shell does not
+// wait for, such as the <(...) commands of a background command line
+pid_t detached_processes[MAX_DETACHED_PROCESSES];
+int detached_count = 0;
+
+// Function to reap detached helper processes that have exited
+void reapDetachedProcesses() {
+    for (int i = detached_count - 1; i >= 0; i--) {
+        if (waitpid(detached_processes[i], NULL, WNOHANG) != 0) {
+            detached_processes[i] = detached_processes[--detached_count];
+        }
+    }
+}
+
+// Function to collect status changes of background and stopped jobs
+// Finished jobs are reported and removed from the job table.
+// Parameters:
+// - report: 1 to print "Done" for finished jobs
+void updateJobStatuses(int report) {
+    reapDetachedProcesses();
+    for (int i = 0; i < MAX_JOBS; i++) {
+        struct Job *job = &jobs[i];
+        if (job->id == 0 || job->foreground) {
+            continue;
+        }
+        for (int j = 0; j < job->numProcesses; j++) {
+            if (job->processes[j].state == JOB_DONE) {
+                continue;
+            }
+            int status;
+            if (waitpid(job->processes[j].pid, &status, WNOHANG | WUNTRACED | WCONTINUED) > 0) {
+                updateJobProcess(job, job->processes[j].pid, status);
+            }
+        }
+        refreshJobState(job);
+        if (job->state == JOB_DONE) {
+            if (report) {
+                printJob(job);
+            }
+            freeJob(job);
+        }
+    }
+}
+
+// Function to find the job named by a "%n" argument
+// Parameters:
+// - spec: "%n", or NULL for the current job (the most recently started or stopped one)
+// Returns:
+//  The job, NULL (after printing an error) if there is no such job
+struct Job *findJob(char *spec) {
+    if (spec == NULL) {
+        struct Job *current = NULL;
+        for (int i = 0; i < MAX_JOBS; i++) {
+            if (jobs[i].id != 0 && (current == NULL || jobs[i].sequence > current->sequence)) {
+                current = &jobs[i];
+            }
+        }
+        if (current == NULL) {
+            printf("No background processes to bring to foreground\n");
+        }
+        return current;
+    }
+
+    char *end;
+    long id = (spec[0] == '%') ? strtol(spec + 1, &end, 10) : -1;
+    if (id < 1 || id > MAX_JOBS || *end != '\0' || jobs[id - 1].id == 0) {
+        printf("Error: No such job %s\n", spec);
+        last_exit_status = 1;
+        return NULL;
+    }
+    return &jobs[id - 1];
+}
+
+// Function to process the job control builtins
+// Parameters:
+// - input: "jobs", "fg [%n]", "bg [%n]", "kill %n" or "stop %n"
+// Example:
+//   processJobBuiltin("fg %2")
+void processJobBuiltin(char input[]) {
+    char *name = strtok(input, " ");
+    char *spec = strtok(NULL, " ");
+    if (strtok(NULL, " ") != NULL) {
+        printf("Error: Incorrect number of arguments for %s\n", name);
+        last_exit_status = 2;
+        return;
+    }
+
+    updateJobStatuses(1);
+
+    if (strcmp(name, "jobs") == 0) {
+        for (int i = 0; i < MAX_JOBS; i++) {
+            if (jobs[i].id != 0) {
+                printJob(&jobs[i]);
+            }
+        }
+        return;
+    }
+
+    struct Job *job = findJob(spec);
+    if (job == NULL) {
+        return;
+    }
+
+    if (strcmp(name, "fg") == 0) {
+        // Bring the job to the foreground and continue it if it was stopped
+        printf("%s\n", job->command);
+        if (job_control_enabled && job->state == JOB_STOPPED) {
+            tcsetattr(shell_terminal, TCSADRAIN, &job->terminalModes);
+        }
+        job->foreground = 1;
+        if (job_control_enabled) {
+            tcsetpgrp(shell_terminal, job->pgid);
+        }
+        signalJob(job, SIGCONT);
+        for (int i = 0; i < job->numProcesses; i++) {
+            if (job->processes[i].state == JOB_STOPPED) {
+                job->processes[i].state = JOB_RUNNING;
+            }
+        }
+        last_exit_status = waitForegroundJob(job);
+    } else if (strcmp(name, "bg") == 0) {
+        // Continue a stopped job in the background
+        signalJob(job, SIGCONT);
+        job->state = JOB_RUNNING;
+        job->sequence = ++job_sequence;
+        printf("[%d] %s\n", job->id, job->command);
+    } else if (strcmp(name, "kill") == 0) {
+        // Continue the job as well so that a stopped job sees SIGTERM
+        signalJob(job, SIGTERM);
+        signalJob(job, SIGCONT);
+    } else if (strcmp(name, "stop") == 0) {
+        signalJob(job, SIGSTOP);
+    }
+}
+
+// Size of the blocks the per-command-line arena allocates from
+#define ARENA_BLOCK_SIZE 4096
+
+// A block of memory owned by the arena
+struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+// Blocks of the arena, the one being allocated from first
+struct ArenaBlock *arena_blocks = NULL;
+// Statistics reported by the memstats builtin
+size_t arena_in_use = 0;
+size_t arena_high_water = 0;
+size_t arena_reserved = 0;
+size_t arena_reserved_high_water = 0;
+long arena_allocations = 0;
+long arena_resets = 0;
+
+// Function to allocate memory that lives until the current command line completes
+// Every parsing and expansion allocation made while processing a command line
+// comes from here and is released at once by arenaReset.
+// Parameters:
+// - size: Number of bytes needed
+// Returns:
+//  Pointer to the memory, NULL if it could not be allocated
+// Example:
+//   char *path = arenaAlloc(strlen(home) + 10);
+void *arenaAlloc(size_t size) {
+    // Keep allocations aligned for any type
+    size = (size + 15) & ~(size_t)15;
+
+    if (arena_blocks == NULL || arena_blocks->size - arena_blocks->used < size) {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        struct ArenaBlock *block = malloc(sizeof(struct ArenaBlock) + blockSize);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = arena_blocks;
+        block->size = blockSize;
+        block->used = 0;
+        arena_blocks = block;
+        arena_reserved += blockSize;
+        if (arena_reserved > arena_reserved_high_water) {
+            arena_reserved_high_water = arena_reserved;
+        }
+    }
+
+    void *memory = arena_blocks->data + arena_blocks->used;
+    arena_blocks->used += size;
+    arena_in_use += size;
+    arena_allocations++;
+    if (arena_in_use > arena_high_water) {
+        arena_high_water = arena_in_use;
+    }
+    return memory;
+}
+
+// Function to release everything allocated from the arena
+// One standard block is kept for the next command line so that the arena
+// does not go back to malloc for every line.
+void arenaReset() {
+    struct ArenaBlock *kept = NULL;
+    while (arena_blocks != NULL) {
+        struct ArenaBlock *block = arena_blocks;
+        arena_blocks = block->next;
+        if (kept == NULL && block->size == ARENA_BLOCK_SIZE) {
+            kept = block;
+        } else {
+            arena_reserved -= block->size;
+            free(block);
+        }
+    }
+    if (kept != NULL) {
+        kept->next = NULL;
+        kept->used = 0;
+    }
+    arena_blocks = kept;
+    arena_in_use = 0;
+    arena_resets++;
+}
+
+// A position in the arena that can be returned to with arenaRelease
+struct ArenaMark {
+    struct ArenaBlock *block;
+    size_t used;
+    size_t inUse;
+};
+
+// Function to remember the current position in the arena
+// Used by commands that run nested command lines, such as source, to
+// free what each nested line allocated without touching the outer line.
+struct ArenaMark arenaMark() {
+    struct ArenaMark mark = {arena_blocks, arena_blocks ? arena_blocks->used : 0, arena_in_use};
+    return mark;
+}
+
+// Function to free everything allocated from the arena since a mark
+void arenaRelease(struct ArenaMark mark) {
+    while (arena_blocks != NULL && arena_blocks != mark.block) {
+        struct ArenaBlock *block = arena_blocks;
+        arena_blocks = block->next;
+        arena_reserved -= block->size;
+        free(block);
+    }
+    if (arena_blocks != NULL) {
+        arena_blocks->used = mark.used;
+    }
+    arena_in_use = mark.inUse;
+}
+
+// Function to print arena statistics and the process RSS for the memstats builtin
+void printMemoryStats() {
+    printf("Arena: %zu bytes in use, high-water %zu bytes\n", arena_in_use, arena_high_water);
+    printf("Arena: %zu bytes reserved, high-water %zu bytes\n", arena_reserved, arena_reserved_high_water);
+    printf("Arena: %ld allocations, %ld resets\n", arena_allocations, arena_resets);
+
+    // Current RSS from /proc/self/statm, peak from getrusage
+    long residentPages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL) {
+        if (fscanf(statm, "%*s %ld", &residentPages) != 1) {
+            residentPages = 0;
+        }
+        fclose(statm);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("RSS: %ld KB, peak %ld KB\n", residentPages * (sysconf(_SC_PAGESIZE) / 1024), usage.ru_maxrss);
+}
 
 // Function to trim leading and trailing whitespace from a string
 // Parameters:
@@ -58,8 +736,11 @@ void trimWhitespace(char *str) {
 // Example:
 //   executeCommand(["ls", "-l", NULL]);
 void executeCommand(char *argsArray[]) {
-    int pid = fork();
-    int status;
+    struct Job *job = createJob(1);
+    if (job == NULL) {
+        return;
+    }
+    int pid = forkJobProcess(job);
 
     if (pid < 0) {
         printf("Fork failed\n");
@@ -68,14 +749,14 @@ void executeCommand(char *argsArray[]) {
 
     if (pid > 0) {
         // Wait for child to finish executing command
-        waitpid(pid, &status, 0);
+        last_exit_status = waitForegroundJob(job);
     } else {
         // execvp returns only incase of failure
         // it returns -1
         int resultOfExec = execvp(argsArray[0], argsArray);
         if (resultOfExec == -1) {
             printf("Execution of command failed %s\n",argsArray[0]);
-            exit(1);
+            exitChild(EXIT_COMMAND_NOT_FOUND);
         }
     }
 }
@@ -105,7 +786,8 @@ void expandHomeDirectory(char *argsArray[]) {
             // Exclude ~
             int pathLength = strlen(argsArray[i]) - 1; 
             // +1 for null terminator
-            char *expandedPath = malloc(homeDirLength + pathLength + 1); 
+            // Released with the rest of the command line by arenaReset
+            char *expandedPath = arenaAlloc(homeDirLength + pathLength + 1); 
             if (expandedPath == NULL) {
                 printf("Error: Memory allocation failed\n");
                 return;
@@ -118,6 +800,41 @@ void expandHomeDirectory(char *argsArray[]) {
     }
 }
 
+// Function to replace $? in arguments with the exit status of the last command
+// Parameters:
+// - argsArray: Array of arguments
+// Example:
+//   expandExitStatus(["echo", "status=$?", NULL]); // after false gives "status=1"
+void expandExitStatus(char *argsArray[]) {
+    char status[16];
+    int statusLength = snprintf(status, sizeof(status), "%d", last_exit_status);
+
+    for (int i = 0; argsArray[i] != NULL; i++) {
+        if (strstr(argsArray[i], "$?") == NULL) {
+            continue;
+        }
+        // Each $? becomes at most statusLength characters
+        // Released with the rest of the command line by arenaReset
+        char *expanded = arenaAlloc(strlen(argsArray[i]) / 2 * statusLength + strlen(argsArray[i]) + 1);
+        if (expanded == NULL) {
+            printf("Error: Memory allocation failed\n");
+            return;
+        }
+        char *out = expanded;
+        for (char *in = argsArray[i]; *in != '\0'; in++) {
+            if (in[0] == '$' && in[1] == '?') {
+                memcpy(out, status, statusLength);
+                out += statusLength;
+                in++;
+            } else {
+                *out++ = *in;
+            }
+        }
+        *out = '\0';
+        argsArray[i] = expanded;
+    }
+}
+
 // Function to execute the "cat" command with a specified file
 // Parameters:
 // - fileName: The name of the file to be displayed
@@ -135,58 +852,689 @@ void executeCatCommand(char *fileName) {
 
 }
 
-// Function to process pipe operations
+// Maximum number of files a single pipe stage can fan its output out to
+#define MAX_FANOUT_SINKS 5
+
+// Function to split the fan-out redirections off a pipe stage
 // Parameters:
-// - input: The input string containing pipe-separated commands
+// - command: The pipe stage, cut at its first '>' on return
+// - sinkFiles: Filled with the names of the files to write to
+// - sinkAppend: Filled with 1 for ">>" sinks and 0 for ">" sinks
+// Returns:
+//  Number of sinks found, 0 if the stage has no redirection
+//  -1 if the redirections are malformed or there are too many of them
 // Example:
-//   processPipeOperation("ls | grep example | cat one.txt");
-void processPipeOperation(char input[]) {
-    // Maximum number of pipes
-    const int MAX_PIPES = 6; 
-    // Maximum number of commands - would be one + number of pipes
-    const int MAX_COMMANDS = MAX_PIPES + 1; 
-    // Maximum number of arguments per command
-    const int MAX_ARGS = 5; 
+//   parseFanOutSinks("ls -l >> a.log > b.out", ...) leaves "ls -l " and returns 2
+int parseFanOutSinks(char *command, char *sinkFiles[], int sinkAppend[]) {
+    char *cursor = strchr(command, '>');
+    if (cursor == NULL) {
+        return 0;
+    }
 
-    // Array to store indiviual commands extracted b/w pipes
-    char *commands[MAX_COMMANDS]; 
+    // Everything before the first '>' is the command itself
+    *cursor = '\0';
+    cursor++;
 
-    int numCommands = 0;
-    // Tokenize input based on "|" - we get indiviual commands
-    char *token = strtok(input, "|");
-    while (token != NULL && numCommands < MAX_COMMANDS) {
-        // Trim leading and trailing whitespace from the command
-        char *trimmedCommand = token;
-        while (*trimmedCommand == ' ' || *trimmedCommand == '\t')
-            ++trimmedCommand;
-        size_t length = strlen(trimmedCommand);
-        while (length > 0 && (trimmedCommand[length - 1] == ' ' || trimmedCommand[length - 1] == '\t'))
-            trimmedCommand[--length] = '\0';
-        if (length > 0) {
-            commands[numCommands++] = trimmedCommand;
-        }
-        // Get pointer to remaining token
-        token = strtok(NULL, "|");
+    int numSinks = 0;
+    int append = 0;
+    if (*cursor == '>') {
+        append = 1;
+        cursor++;
     }
 
-    // Check if more commands present after tokenization limit
-    if (token != NULL) {
-        printf("Error: Too many pipe commands (up to 6 operations)\n");
-        return;
-    }
+    while (1) {
+        // Skip whitespace before the file name
+        while (*cursor == ' ' || *cursor == '\t') {
+            cursor++;
+        }
+        char *fileName = cursor;
+        while (*cursor != '\0' && *cursor != ' ' && *cursor != '\t' && *cursor != '>') {
+            cursor++;
+        }
+        if (cursor == fileName || numSinks == MAX_FANOUT_SINKS) {
+            return -1;
+        }
+        sinkFiles[numSinks] = fileName;
+        sinkAppend[numSinks] = append;
+        numSinks++;
 
-    // Create pipes
-    int pipes[MAX_PIPES][2];
-    for (int i = 0; i < MAX_PIPES; i++) {
-        if (pipe(pipes[i]) == -1) {
-            perror("Pipe creation failed");
-            exit(EXIT_FAILURE);
+        // Terminate the file name and look for the next '>' or '>>'
+        while (*cursor == ' ' || *cursor == '\t') {
+            *cursor++ = '\0';
+        }
+        if (*cursor == '\0') {
+            return numSinks;
+        }
+        *cursor++ = '\0';
+        append = 0;
+        if (*cursor == '>') {
+            append = 1;
+            cursor++;
         }
     }
+}
 
-    // Execute commands - one by one
-    for (int i = 0; i < numCommands; i++) {
-        int argsCount = 0;
+// Function to move exactly length bytes from one pipe to another fd with splice
+// Parameters:
+// - inFd: Read end of the pipe holding the data
+// - outFd: File or pipe receiving the data
+// - length: Number of bytes to move
+// Returns:
+//  0 on success, -1 if splice fails or the input ends early
+int spliceAll(int inFd, int outFd, ssize_t length) {
+    while (length > 0) {
+        ssize_t moved = splice(inFd, NULL, outFd, NULL, length, SPLICE_F_MOVE);
+        if (moved <= 0) {
+            return -1;
+        }
+        length -= moved;
+    }
+    return 0;
+}
+
+// Function to copy a pipe stage's output to several sinks without a user space copy
+// Every sink except the last gets its own intermediate pipe filled with tee(2)
+// and drained into the sink with splice(2); the last sink consumes the data
+// straight from the input pipe.
+// Parameters:
+// - inFd: Read end of the pipe the producing command writes to
+// - sinkFds: Files to write to
+// - numSinks: Number of files in sinkFds
+// - nextFd: Write end of the pipe to the next stage, -1 for the last stage
+// Example:
+//   fanOutStream(fd, {a.log, b.out}, 2, nextPipe) for "cmd >> a.log > b.out | next"
+void fanOutStream(int inFd, int sinkFds[], int numSinks, int nextFd) {
+    int teePipes[MAX_FANOUT_SINKS][2];
+
+    // When there is no next stage the last file is fed from the input pipe itself
+    int numTees = (nextFd == -1) ? numSinks - 1 : numSinks;
+    int lastFd = (nextFd == -1) ? sinkFds[numSinks - 1] : nextFd;
+
+    for (int i = 0; i < numTees; i++) {
+        if (pipe(teePipes[i]) == -1) {
+            perror("Pipe creation failed");
+            exitChild(EXIT_FAILURE);
+        }
+        // Intermediate pipes are drained every round so as big as the input
+        // pipe is enough for tee to copy everything it is asked to
+        fcntl(teePipes[i][1], F_SETPIPE_SZ, fcntl(inFd, F_GETPIPE_SZ));
+    }
+
+    while (1) {
+        // Blocks until the producer has written something or closed the pipe
+        ssize_t length = (numTees > 0) ? tee(inFd, teePipes[0][1], INT_MAX, 0)
+                               : splice(inFd, NULL, lastFd, NULL, INT_MAX, SPLICE_F_MOVE);
+        if (length == 0) {
+            break;
+        }
+        if (length < 0) {
+            perror("Fan-out failed");
+            exitChild(EXIT_FAILURE);
+        }
+        if (numTees == 0) {
+            continue;
+        }
+
+        // Duplicate the same bytes into the remaining intermediate pipes
+        for (int i = 1; i < numTees; i++) {
+            if (tee(inFd, teePipes[i][1], length, 0) != length) {
+                perror("Fan-out failed");
+                exitChild(EXIT_FAILURE);
+            }
+        }
+
+        // Drain every intermediate pipe into its file
+        for (int i = 0; i < numTees; i++) {
+            if (spliceAll(teePipes[i][0], sinkFds[i], length) == -1) {
+                perror("Fan-out failed");
+                exitChild(EXIT_FAILURE);
+            }
+        }
+
+        // Consume the data from the input pipe into the last sink
+        if (spliceAll(inFd, lastFd, length) == -1) {
+            perror("Fan-out failed");
+            exitChild(EXIT_FAILURE);
+        }
+    }
+}
+
+// Function to open the files a pipe stage fans its output out to
+// Files are opened close-on-exec so only the fan-out helper keeps them.
+// ">>" files are positioned at their end instead of using O_APPEND
+// because splice(2) refuses to write to files opened in append mode.
+// Parameters:
+// - sinkFiles: Names of the files
+// - sinkAppend: 1 for files to append to, 0 for files to truncate
+// - numSinks: Number of files
+// - sinkFds: Filled with the opened file descriptors
+// Returns:
+//  0 on success, -1 if a file could not be opened
+int openFanOutSinks(char *sinkFiles[], int sinkAppend[], int numSinks, int sinkFds[]) {
+    // Replace ~ with $HOME in file names
+    char *fileNames[MAX_FANOUT_SINKS + 1];
+    for (int i = 0; i < numSinks; i++) {
+        fileNames[i] = sinkFiles[i];
+    }
+    fileNames[numSinks] = NULL;
+    expandHomeDirectory(fileNames);
+    expandExitStatus(fileNames);
+
+    // Set umask as 0
+    umask(0);
+
+    for (int i = 0; i < numSinks; i++) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (sinkAppend[i] ? 0 : O_TRUNC);
+        sinkFds[i] = open(fileNames[i], flags, 0777);
+        if (sinkFds[i] == -1) {
+            perror("Error opening output file");
+            for (int j = 0; j < i; j++) {
+                close(sinkFds[j]);
+            }
+            return -1;
+        }
+        if (sinkAppend[i]) {
+            lseek(sinkFds[i], 0, SEEK_END);
+        }
+    }
+    return 0;
+}
+
+// Function to close the fan-out files of the first numCommands pipe stages
+void closeFanOutSinks(int sinkFds[][MAX_FANOUT_SINKS], int numSinks[], int numCommands) {
+    for (int i = 0; i < numCommands; i++) {
+        for (int j = 0; j < numSinks[i]; j++) {
+            close(sinkFds[i][j]);
+        }
+    }
+}
+
+// Maximum number of copies a data-parallel pipe stage can start
+#define MAX_SHARD_WORKERS 16
+// Size of the line-aligned chunks a data-parallel stage hands to its copies
+#define SHARD_CHUNK_SIZE (64 * 1024)
+// Chunk size a stage merged in input order uses when its input is not a file,
+// large enough that the cost of starting a copy per chunk is spread out
+#define SHARD_ORDERED_CHUNK_SIZE (8 * 1024 * 1024)
+
+// One copy of a data-parallel pipe stage as seen by its coordinator
+struct ShardWorker {
+    pid_t pid;              // Process ID, 0 when the slot is unused
+    int inFd;               // Write end of the copy's stdin, -1 once closed
+    int outFd;              // Read end of the copy's stdout, -1 at EOF
+    char *pending;          // Input not yet written to the copy
+    size_t pendingLength;
+    size_t pendingOffset;
+    char *output;           // Output not yet written to stdout
+    size_t outputLength;
+    size_t outputCapacity;
+    int exitStatus;
+};
+
+// Function to parse the "@N" modifier of a data-parallel pipe stage
+// Parameters:
+// - arg: The last argument of the stage
+// - ordered: Set to 1 for "@No" (merge in input order), 0 for "@N" (arrival order)
+// Returns:
+//  Number of copies, 0 if arg is not a modifier, -1 if it is out of range
+// Example:
+//   parseShardModifier("@4", &ordered) returns 4
+int parseShardModifier(char *arg, int *ordered) {
+    if (arg[0] != '@' || !isdigit((unsigned char)arg[1])) {
+        return 0;
+    }
+    char *suffix;
+    long numWorkers = strtol(arg + 1, &suffix, 10);
+    *ordered = (*suffix == 'o');
+    if (*ordered) {
+        suffix++;
+    }
+    if (*suffix != '\0' || numWorkers < 1 || numWorkers > MAX_SHARD_WORKERS) {
+        return -1;
+    }
+    return numWorkers;
+}
+
+// Function to append bytes to a growable buffer
+// Returns:
+//  0 on success, -1 if memory could not be allocated
+int appendToBuffer(char **buffer, size_t *length, size_t *capacity, const char *data, size_t dataLength) {
+    if (*length + dataLength > *capacity) {
+        size_t newCapacity = *capacity ? *capacity : SHARD_CHUNK_SIZE;
+        while (newCapacity < *length + dataLength) {
+            newCapacity *= 2;
+        }
+        char *grown = realloc(*buffer, newCapacity);
+        if (grown == NULL) {
+            return -1;
+        }
+        *buffer = grown;
+        *capacity = newCapacity;
+    }
+    memcpy(*buffer + *length, data, dataLength);
+    *length += dataLength;
+    return 0;
+}
+
+// Function to write a whole buffer to stdout, exiting if the reader went away
+void writeShardOutput(const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, length);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            exitChild(EXIT_FAILURE);
+        }
+        data += written;
+        length -= written;
+    }
+}
+
+// Function to start one copy of a data-parallel stage
+// Parameters:
+// - argsArray: The stage's command and arguments
+// - worker: Slot to fill with the copy's process ID and pipe ends
+// Returns:
+//  0 on success, -1 on failure
+int startShardWorker(char *argsArray[], struct ShardWorker *worker) {
+    int inPipe[2];
+    int outPipe[2];
+    // Close-on-exec keeps every copy from holding its siblings' pipes open
+    if (pipe2(inPipe, O_CLOEXEC) == -1) {
+        return -1;
+    }
+    if (pipe2(outPipe, O_CLOEXEC) == -1) {
+        close(inPipe[0]);
+        close(inPipe[1]);
+        return -1;
+    }
+
+    int pid = fork();
+    if (pid < 0) {
+        close(inPipe[0]);
+        close(inPipe[1]);
+        close(outPipe[0]);
+        close(outPipe[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        // Child process reads its share of the input and writes to the coordinator
+        signal(SIGPIPE, SIG_DFL);
+        if (dup2(inPipe[0], STDIN_FILENO) == -1 || dup2(outPipe[1], STDOUT_FILENO) == -1) {
+            perror("Dup2 failed");
+            exitChild(EXIT_FAILURE);
+        }
+        if (execvp(argsArray[0], argsArray) == -1) {
+            printf("Execution of command failed %s\n",argsArray[0]);
+            exitChild(EXIT_COMMAND_NOT_FOUND);
+        }
+    }
+
+    close(inPipe[0]);
+    close(outPipe[1]);
+    fcntl(inPipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(outPipe[0], F_SETFL, O_NONBLOCK);
+
+    memset(worker, 0, sizeof(*worker));
+    worker->pid = pid;
+    worker->inFd = inPipe[1];
+    worker->outFd = outPipe[0];
+    return 0;
+}
+
+// Function to wait for a copy whose output has ended and release its slot
+// Returns:
+//  Exit status of the copy
+int finishShardWorker(struct ShardWorker *worker) {
+    int status = 0;
+    if (worker->inFd != -1) {
+        close(worker->inFd);
+    }
+    waitpid(worker->pid, &status, 0);
+    free(worker->pending);
+    free(worker->output);
+    worker->pid = 0;
+    return decodeWaitStatus(status);
+}
+
+// Function to run a pipe stage as several copies over line-aligned chunks of stdin
+// Runs inside the stage's child process with stdin and stdout already wired.
+// In arrival order numWorkers long-lived copies receive the chunks round-robin
+// and their output is merged line by line as it arrives. In input order every
+// chunk gets its own copy, at most numWorkers at a time, and the outputs are
+// written in chunk order.
+// Parameters:
+// - argsArray: The stage's command and arguments
+// - numWorkers: Number of copies running at once
+// - ordered: 1 to merge outputs in input order, 0 for arrival order
+// Returns:
+//  0 if every copy succeeded, otherwise the first failing exit status
+// Example:
+//   "cat huge.log | grep error @4 | wc -l" runs grep as 4 copies
+int runShardedStage(char *argsArray[], int numWorkers, int ordered) {
+    struct ShardWorker workers[MAX_SHARD_WORKERS];
+    memset(workers, 0, sizeof(workers));
+
+    // Writes to a copy that exited early must not kill the coordinator
+    signal(SIGPIPE, SIG_IGN);
+
+    int exitStatus = 0;
+    int inputOpen = 1;
+    // Input order starts a copy per chunk, so its chunks are much larger: one
+    // share per copy when the input is a file, otherwise a large fixed size
+    size_t chunkSize = SHARD_CHUNK_SIZE;
+    if (ordered) {
+        struct stat inputStat;
+        chunkSize = SHARD_ORDERED_CHUNK_SIZE;
+        if (fstat(STDIN_FILENO, &inputStat) == 0 && S_ISREG(inputStat.st_mode)) {
+            chunkSize = (size_t)inputStat.st_size / numWorkers + 1;
+            if (chunkSize < SHARD_CHUNK_SIZE) {
+                chunkSize = SHARD_CHUNK_SIZE;
+            }
+        }
+    }
+    char *carry = malloc(chunkSize);
+    size_t carryLength = 0;
+    // Arrival order: next copy to hand a chunk to
+    // Input order: oldest running copy, whose output goes straight to stdout
+    int current = 0;
+    int running = 0;
+
+    if (carry == NULL) {
+        perror("Memory allocation failed");
+        return EXIT_FAILURE;
+    }
+
+    if (!ordered) {
+        for (int i = 0; i < numWorkers; i++) {
+            if (startShardWorker(argsArray, &workers[i]) == -1) {
+                perror("Starting parallel stage failed");
+                exitChild(EXIT_FAILURE);
+            }
+            running++;
+        }
+    }
+
+    while (running > 0 || (ordered && inputOpen)) {
+        // Skip copies that exited early when handing out chunks
+        while (!ordered && workers[current].pid == 0) {
+            current = (current + 1) % numWorkers;
+        }
+
+        struct pollfd pollFds[1 + 2 * MAX_SHARD_WORKERS];
+        struct ShardWorker *pollWorkers[1 + 2 * MAX_SHARD_WORKERS];
+        int numPollFds = 0;
+
+        // Only read more input once the copy it will go to can take it
+        int acceptInput = inputOpen && (ordered ? running < numWorkers
+                                                : workers[current].pendingLength == 0);
+        if (acceptInput) {
+            pollFds[numPollFds].fd = STDIN_FILENO;
+            pollFds[numPollFds].events = POLLIN;
+            pollWorkers[numPollFds++] = NULL;
+        }
+        for (int i = 0; i < numWorkers; i++) {
+            if (workers[i].pid == 0) {
+                continue;
+            }
+            if (workers[i].pendingLength > 0) {
+                pollFds[numPollFds].fd = workers[i].inFd;
+                pollFds[numPollFds].events = POLLOUT;
+                pollWorkers[numPollFds++] = &workers[i];
+            }
+            if (workers[i].outFd != -1) {
+                pollFds[numPollFds].fd = workers[i].outFd;
+                pollFds[numPollFds].events = POLLIN;
+                pollWorkers[numPollFds++] = &workers[i];
+            }
+        }
+
+        if (poll(pollFds, numPollFds, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Poll failed");
+            exitChild(EXIT_FAILURE);
+        }
+
+        for (int p = 0; p < numPollFds; p++) {
+            struct ShardWorker *worker = pollWorkers[p];
+            if (pollFds[p].revents == 0) {
+                continue;
+            }
+
+            if (worker == NULL) {
+                // Read input and cut it after the last complete line
+                ssize_t bytesRead = read(STDIN_FILENO, carry + carryLength, chunkSize - carryLength);
+                if (bytesRead == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (bytesRead <= 0) {
+                    inputOpen = 0;
+                } else {
+                    carryLength += bytesRead;
+                }
+
+                // In input order keep reading until the chunk is full
+                if (ordered && inputOpen && carryLength < chunkSize) {
+                    continue;
+                }
+
+                size_t chunkLength = carryLength;
+                if (inputOpen) {
+                    while (chunkLength > 0 && carry[chunkLength - 1] != '\n') {
+                        chunkLength--;
+                    }
+                    // A single line longer than a chunk is split anyway
+                    if (chunkLength == 0 && carryLength == chunkSize) {
+                        chunkLength = carryLength;
+                    }
+                }
+                if (chunkLength == 0) {
+                    continue;
+                }
+
+                struct ShardWorker *target;
+                if (ordered) {
+                    target = &workers[(current + running) % numWorkers];
+                    if (startShardWorker(argsArray, target) == -1) {
+                        perror("Starting parallel stage failed");
+                        exitChild(EXIT_FAILURE);
+                    }
+                    running++;
+                } else {
+                    target = &workers[current];
+                    current = (current + 1) % numWorkers;
+                }
+
+                size_t pendingCapacity = 0;
+                target->pendingOffset = 0;
+                target->pendingLength = 0;
+                if (appendToBuffer(&target->pending, &target->pendingLength, &pendingCapacity, carry, chunkLength) == -1) {
+                    perror("Memory allocation failed");
+                    exitChild(EXIT_FAILURE);
+                }
+                memmove(carry, carry + chunkLength, carryLength - chunkLength);
+                carryLength -= chunkLength;
+            } else if (pollFds[p].events == POLLOUT) {
+                // Feed the copy its pending input
+                ssize_t written = write(worker->inFd, worker->pending + worker->pendingOffset,
+                                        worker->pendingLength - worker->pendingOffset);
+                if (written > 0) {
+                    worker->pendingOffset += written;
+                } else if (errno != EAGAIN && errno != EINTR) {
+                    // The copy stopped reading, drop its input
+                    worker->pendingOffset = worker->pendingLength;
+                }
+                if (worker->pendingOffset == worker->pendingLength) {
+                    worker->pendingLength = 0;
+                    worker->pendingOffset = 0;
+                    // Each chunk has its own copy in input order
+                    if (ordered) {
+                        close(worker->inFd);
+                        worker->inFd = -1;
+                    }
+                }
+            } else {
+                // Collect output from the copy
+                char buffer[SHARD_CHUNK_SIZE];
+                ssize_t bytesRead = read(worker->outFd, buffer, sizeof(buffer));
+                if (bytesRead == -1 && (errno == EAGAIN || errno == EINTR)) {
+                    continue;
+                }
+                if (bytesRead > 0) {
+                    if (ordered && worker == &workers[current]) {
+                        writeShardOutput(buffer, bytesRead);
+                    } else if (appendToBuffer(&worker->output, &worker->outputLength, &worker->outputCapacity, buffer, bytesRead) == -1) {
+                        perror("Memory allocation failed");
+                        exitChild(EXIT_FAILURE);
+                    }
+                    if (!ordered) {
+                        // Emit complete lines only so copies do not interleave mid-line
+                        size_t lineEnd = worker->outputLength;
+                        while (lineEnd > 0 && worker->output[lineEnd - 1] != '\n') {
+                            lineEnd--;
+                        }
+                        writeShardOutput(worker->output, lineEnd);
+                        memmove(worker->output, worker->output + lineEnd, worker->outputLength - lineEnd);
+                        worker->outputLength -= lineEnd;
+                    }
+                    continue;
+                }
+
+                // End of the copy's output
+                close(worker->outFd);
+                worker->outFd = -1;
+                if (!ordered) {
+                    writeShardOutput(worker->output, worker->outputLength);
+                    int status = finishShardWorker(worker);
+                    exitStatus = exitStatus ? exitStatus : status;
+                    running--;
+                }
+            }
+        }
+
+        if (!ordered && !inputOpen && carryLength == 0) {
+            // No more chunks: close the input of copies that have written everything
+            for (int i = 0; i < numWorkers; i++) {
+                if (workers[i].pid != 0 && workers[i].inFd != -1 && workers[i].pendingLength == 0) {
+                    close(workers[i].inFd);
+                    workers[i].inFd = -1;
+                }
+            }
+        }
+
+        if (ordered) {
+            // Retire finished copies in input order, writing their buffered output
+            while (running > 0 && workers[current].outFd == -1) {
+                writeShardOutput(workers[current].output, workers[current].outputLength);
+                int status = finishShardWorker(&workers[current]);
+                exitStatus = exitStatus ? exitStatus : status;
+                running--;
+                current = (current + 1) % numWorkers;
+                if (running > 0) {
+                    writeShardOutput(workers[current].output, workers[current].outputLength);
+                    workers[current].outputLength = 0;
+                }
+            }
+        }
+    }
+
+    free(carry);
+    return exitStatus;
+}
+
+// Function to process pipe operations
+// Fan-out stages such as "ls >> a.log > b.out | wc" copy their output to
+// every listed file as well as to the next stage (see fanOutStream).
+// Stages ending in "@N" run as N copies over chunks of their input (see runShardedStage).
+// Parameters:
+// - input: The input string containing pipe-separated commands
+// Example:
+//   processPipeOperation("ls | grep example | cat one.txt");
+//   processPipeOperation("ls -l >> all.log > last.out | wc -l");
+//   processPipeOperation("cat huge.log | grep error @4 | wc -l");
+void processPipeOperation(char input[]) {
+    // Maximum number of pipes
+    const int MAX_PIPES = 6; 
+    // Maximum number of commands - would be one + number of pipes
+    const int MAX_COMMANDS = MAX_PIPES + 1; 
+    // Maximum number of arguments per command
+    const int MAX_ARGS = 5; 
+
+    // Array to store indiviual commands extracted b/w pipes
+    char *commands[MAX_COMMANDS]; 
+
+    int numCommands = 0;
+    // Tokenize input based on "|" - we get indiviual commands
+    char *token = strtok(input, "|");
+    while (token != NULL && numCommands < MAX_COMMANDS) {
+        // Trim leading and trailing whitespace from the command
+        char *trimmedCommand = token;
+        while (*trimmedCommand == ' ' || *trimmedCommand == '\t')
+            ++trimmedCommand;
+        size_t length = strlen(trimmedCommand);
+        while (length > 0 && (trimmedCommand[length - 1] == ' ' || trimmedCommand[length - 1] == '\t'))
+            trimmedCommand[--length] = '\0';
+        if (length > 0) {
+            commands[numCommands++] = trimmedCommand;
+        }
+        // Get pointer to remaining token
+        token = strtok(NULL, "|");
+    }
+
+    // Check if more commands present after tokenization limit
+    if (token != NULL) {
+        printf("Error: Too many pipe commands (up to 6 operations)\n");
+        last_exit_status = 2;
+        return;
+    }
+
+    // Every command and helper of the pipeline belongs to one job
+    struct Job *job = createJob(1);
+    if (job == NULL) {
+        return;
+    }
+
+    // Open the fan-out files of every stage before anything is forked
+    // so that a bad file name does not leave half a pipeline running
+    int numSinks[MAX_COMMANDS];
+    int sinkFds[MAX_COMMANDS][MAX_FANOUT_SINKS];
+    for (int i = 0; i < numCommands; i++) {
+        char *sinkFiles[MAX_FANOUT_SINKS];
+        int sinkAppend[MAX_FANOUT_SINKS];
+        numSinks[i] = parseFanOutSinks(commands[i], sinkFiles, sinkAppend);
+        if (numSinks[i] == -1) {
+            printf("Error: Invalid redirection for command %d (up to %d files allowed)\n", i + 1, MAX_FANOUT_SINKS);
+            last_exit_status = 2;
+            closeFanOutSinks(sinkFds, numSinks, i);
+            freeJob(job);
+            return;
+        }
+        if (openFanOutSinks(sinkFiles, sinkAppend, numSinks[i], sinkFds[i]) == -1) {
+            closeFanOutSinks(sinkFds, numSinks, i);
+            freeJob(job);
+            return;
+        }
+    }
+
+    // Create pipes
+    int pipes[MAX_PIPES][2];
+    for (int i = 0; i < MAX_PIPES; i++) {
+        if (pipe(pipes[i]) == -1) {
+            perror("Pipe creation failed");
+            exitChild(EXIT_FAILURE);
+        }
+    }
+
+    // Set when a stage turns out to be invalid after earlier stages were started
+    int failed = 0;
+
+    // Execute commands - one by one
+    for (int i = 0; i < numCommands; i++) {
+        int argsCount = 0;
         // Argument array for execvp
         char *argsArray[MAX_ARGS + 1]; 
 
@@ -200,17 +1548,41 @@ void processPipeOperation(char input[]) {
         // Null-terminate the argument array
         argsArray[argsCount] = NULL;
 
+        // A trailing "@N" or "@No" runs N copies of this stage
+        int ordered = 0;
+        int numWorkers = (argsCount > 1) ? parseShardModifier(argsArray[argsCount - 1], &ordered) : 0;
+        if (numWorkers == -1) {
+            printf("Error: Invalid parallel stage modifier for command %d (@1 to @%d)\n", i + 1, MAX_SHARD_WORKERS);
+            failed = 1;
+            break;
+        }
+        if (numWorkers > 0) {
+            argsArray[--argsCount] = NULL;
+        }
+
         // Check if the number of arguments exceeds the limit
         if (argsCount >= MAX_ARGS) {
             printf("Error: Too many arguments for command %d (up to 5 arguments allowed)\n", i + 1);
-            return;
+            failed = 1;
+            break;
         }
 
-        // Fork a child process for each command
-        pid_t pid = fork();
+        // $? is the status of the command before the pipeline
+        expandExitStatus(argsArray);
+
+        // A stage with fan-out writes into its own pipe which a helper
+        // process duplicates to the files and the next stage
+        int fanOutPipe[2];
+        if (numSinks[i] > 0 && pipe2(fanOutPipe, O_CLOEXEC) == -1) {
+            perror("Pipe creation failed");
+            exitChild(EXIT_FAILURE);
+        }
+
+        // Fork a child process for each command, all in the pipeline's job
+        pid_t pid = forkJobProcess(job);
         if (pid < 0) {
             perror("Fork failed");
-            exit(EXIT_FAILURE);
+            exitChild(EXIT_FAILURE);
         } else if (pid == 0) {
             // Child process
             // For i=0 we need input from stdin
@@ -219,17 +1591,23 @@ void processPipeOperation(char input[]) {
                 // Redirect stdin from the read end of the previous pipe
                 if (dup2(pipes[i - 1][0], STDIN_FILENO) == -1) {
                     perror("Dup2 failed");
-                    exit(EXIT_FAILURE);
+                    exitChild(EXIT_FAILURE);
                 }
             }
 
+            // Fan-out stages write to the helper's pipe
             // For last command we need to direct output to stdout
             // Otherwise to current pipe
-            if (i != numCommands - 1) {
+            if (numSinks[i] > 0) {
+                if (dup2(fanOutPipe[1], STDOUT_FILENO) == -1) {
+                    perror("Dup2 failed");
+                    exitChild(EXIT_FAILURE);
+                }
+            } else if (i != numCommands - 1) {
                 // Redirect stdout to the write end of the current pipe
                 if (dup2(pipes[i][1], STDOUT_FILENO) == -1) {
                     perror("Dup2 failed");
-                    exit(EXIT_FAILURE);
+                    exitChild(EXIT_FAILURE);
                 }
             }
 
@@ -239,11 +1617,45 @@ void processPipeOperation(char input[]) {
                 close(pipes[j][1]);
             }
 
+            // Data-parallel stages are coordinated from this child
+            if (numWorkers > 1) {
+                exitChild(runShardedStage(argsArray, numWorkers, ordered));
+            }
+
             // Execute the command
             if (execvp(argsArray[0], argsArray) == -1) {
                 printf("Execution of command failed %s\n",argsArray[0]);
+                exitChild(EXIT_COMMAND_NOT_FOUND);
+            }
+        }
+        // The status of the pipeline is the status of its last command
+        int commandIndex = job->numProcesses - 1;
+
+        if (numSinks[i] > 0) {
+            // Fork the fan-out helper for this stage
+            pid = forkJobProcess(job);
+            if (pid < 0) {
+                perror("Fork failed");
                 exit(EXIT_FAILURE);
+            } else if (pid == 0) {
+                int nextFd = (i != numCommands - 1) ? pipes[i][1] : -1;
+
+                // Keep only the pipe to the next stage open so it sees EOF
+                close(fanOutPipe[1]);
+                for (int j = 0; j < MAX_PIPES; j++) {
+                    close(pipes[j][0]);
+                    if (pipes[j][1] != nextFd) {
+                        close(pipes[j][1]);
+                    }
+                }
+
+                fanOutStream(fanOutPipe[0], sinkFds[i], numSinks[i], nextFd);
+                exitChild(EXIT_SUCCESS);
             }
+            job->processes[job->numProcesses - 1].helper = 1;
+            job->statusIndex = commandIndex;
+            close(fanOutPipe[0]);
+            close(fanOutPipe[1]);
         }
     }
 
@@ -252,10 +1664,12 @@ void processPipeOperation(char input[]) {
         close(pipes[i][0]);
         close(pipes[i][1]);
     }
+    closeFanOutSinks(sinkFds, numSinks, numCommands);
 
     // Wait for all child processes to finish
-    for (int i = 0; i < numCommands; i++) {
-        wait(NULL);
+    last_exit_status = waitForegroundJob(job);
+    if (failed) {
+        last_exit_status = 1;
     }
 }
 
@@ -284,6 +1698,7 @@ void processFileConcatenation(char input[]){
     // Check if more files remaining after tokenization - it means more than 5 operations/6
     if (token != NULL) {
         printf("Error: File concatenation (upto 5 operations / 6 Files)\n");
+        last_exit_status = 2;
         return;
     }
 
@@ -291,6 +1706,7 @@ void processFileConcatenation(char input[]){
 
     // Expand ~ sign in filepath if needed
     expandHomeDirectory(argsArray);
+    expandExitStatus(argsArray);
 
     // Execute cat command for each file
     for(int i=0;argsArray[i]!=NULL;i++){
@@ -320,6 +1736,7 @@ void processNormalCommand(char input[]){
     // Check if more arguments present after tokenization limit
     if (token != NULL) {
         printf("Error: Incorrect number of arguments should be >=1 and <=5\n");
+        last_exit_status = 2;
         return;
     }
 
@@ -327,6 +1744,7 @@ void processNormalCommand(char input[]){
 
     // Replace ~ with $HOME in commands
     expandHomeDirectory(argsArray);
+    expandExitStatus(argsArray);
     executeCommand(argsArray);
 }
 
@@ -354,6 +1772,7 @@ void processNormalCommandWithInputFile(char *command, char *inputFile){
     // Check if more arguments present after tokenization limit
     if (token != NULL) {
         printf("Error: Incorrect number of arguments should be >=1 and <=5\n");
+        last_exit_status = 2;
         return;
     }
 
@@ -361,16 +1780,23 @@ void processNormalCommandWithInputFile(char *command, char *inputFile){
 
     // change ~ to $HOME in command
     expandHomeDirectory(argsArray);
+    expandExitStatus(argsArray);
 
     // Open input file in read only mode
     int fd = open(inputFile, O_RDONLY);
     if (fd == -1) {
-        printf("Error opening input file");
-        exit(1);
+        perror("Error opening input file");
+        last_exit_status = 1;
+        return;
     }
 
     // Create a child process
-    int pid = fork();
+    struct Job *job = createJob(1);
+    if (job == NULL) {
+        close(fd);
+        return;
+    }
+    int pid = forkJobProcess(job);
     if (pid == -1) {
         printf("Fork failed");
         close(fd);
@@ -383,7 +1809,7 @@ void processNormalCommandWithInputFile(char *command, char *inputFile){
         if (dup2(fd, STDIN_FILENO) == -1) {
             printf("Error redirecting input");
             close(fd);
-            exit(EXIT_FAILURE);
+            exitChild(EXIT_FAILURE);
         }
 
         // Close the file descriptor since it's no longer needed in the child process
@@ -392,13 +1818,12 @@ void processNormalCommandWithInputFile(char *command, char *inputFile){
         // Execute the command
         if (execvp(argsArray[0], argsArray) == -1) {
             printf("Execution of command failed %s\n",argsArray[0]);
-            exit(EXIT_FAILURE);
+            exitChild(EXIT_COMMAND_NOT_FOUND);
         }
     } else {
         // Parent process
-        int status;
         // Wait for child process
-        waitpid(pid, &status, 0);
+        last_exit_status = waitForegroundJob(job);
         close(fd);
     }
 }
@@ -426,6 +1851,7 @@ void processNormalCommandWithOutputFile(char *command, char *outputFile){
     // Check if more arguments present after tokenization limit
     if (token != NULL) {
         printf("Error: Incorrect number of arguments should be >=1 and <=5\n");
+        last_exit_status = 2;
         return;
     }
 
@@ -433,6 +1859,7 @@ void processNormalCommandWithOutputFile(char *command, char *outputFile){
 
     // Replace ~ with $HOME
     expandHomeDirectory(argsArray);
+    expandExitStatus(argsArray);
     
     // Set umask as 0
     umask(0);
@@ -441,11 +1868,17 @@ void processNormalCommandWithOutputFile(char *command, char *outputFile){
     int fd = open(outputFile, O_WRONLY | O_CREAT | O_TRUNC, 0777);
     if (fd == -1) {
         perror("Error opening output file");
-        exit(1);
+        last_exit_status = 1;
+        return;
     }
 
     // Fork a child process
-    int pid = fork();
+    struct Job *job = createJob(1);
+    if (job == NULL) {
+        close(fd);
+        return;
+    }
+    int pid = forkJobProcess(job);
     if (pid == -1) {
         printf("Fork failed");
         close(fd);
@@ -458,7 +1891,7 @@ void processNormalCommandWithOutputFile(char *command, char *outputFile){
         if (dup2(fd, STDOUT_FILENO) == -1) {
             printf("Error redirecting input\n");
             close(fd);
-            exit(EXIT_FAILURE);
+            exitChild(EXIT_FAILURE);
         }
 
         // Close the file descriptor since it's no longer needed in the child process
@@ -467,13 +1900,12 @@ void processNormalCommandWithOutputFile(char *command, char *outputFile){
         // Execute the command
         if (execvp(argsArray[0], argsArray) == -1) {
             printf("Execution of command failed %s\n",argsArray[0]);
-            exit(EXIT_FAILURE);
+            exitChild(EXIT_COMMAND_NOT_FOUND);
         }
     } else {
         // Parent process
-        int status;
-        // Wait for Child process
-        waitpid(pid, &status, 0);
+        // Wait for child process
+        last_exit_status = waitForegroundJob(job);
         close(fd);
     }
 }
@@ -501,6 +1933,7 @@ void processNormalCommandWithAppendOutputFile(char *command, char *outputFile){
     // Check if more arguments present after tokenization limit
     if (token != NULL) {
         printf("Error: Incorrect number of arguments should be >=1 and <=5\n");
+        last_exit_status = 2;
         return;
     }
 
@@ -508,6 +1941,7 @@ void processNormalCommandWithAppendOutputFile(char *command, char *outputFile){
 
     // Replace ~ with $HOME
     expandHomeDirectory(argsArray);
+    expandExitStatus(argsArray);
     
     // Set umask as 0
     umask(0);
@@ -516,12 +1950,18 @@ void processNormalCommandWithAppendOutputFile(char *command, char *outputFile){
     int fd = open(outputFile, O_WRONLY | O_CREAT | O_APPEND, 0777);
     if (fd == -1) {
         perror("Error opening output file");
-        exit(1);
+        last_exit_status = 1;
+        return;
     }
 
     // Fork a child process
-    int pid = fork();
-    if (pid == -1) {
+    struct Job *job = createJob(1);
+    if (job == NULL) {
+        close(fd);
+        return;
+    }
+    int pid = forkJobProcess(job);
+    if (pid == -1) {
         printf("Fork failed");
         close(fd);
         exit(1);
@@ -533,7 +1973,7 @@ void processNormalCommandWithAppendOutputFile(char *command, char *outputFile){
         if (dup2(fd, STDOUT_FILENO) == -1) {
             printf("Error redirecting input\n");
             close(fd);
-            exit(EXIT_FAILURE);
+            exitChild(EXIT_FAILURE);
         }
 
         // Close the file descriptor since it's no longer needed in the child process
@@ -542,13 +1982,12 @@ void processNormalCommandWithAppendOutputFile(char *command, char *outputFile){
         // Execute the command
         if (execvp(argsArray[0], argsArray) == -1) {
             printf("Execution of command failed %s\n",argsArray[0]);
-            exit(EXIT_FAILURE);
+            exitChild(EXIT_COMMAND_NOT_FOUND);
         }
     } else {
         // Parent process
-        int status;
         // Wait for child process
-        waitpid(pid, &status, 0);
+        last_exit_status = waitForegroundJob(job);
         close(fd);
     }
 }
@@ -617,39 +2056,43 @@ void processRedirection(char input[]){
 // Parameters:
 // - argsArray: Array of strings where the first element is the command and the rest are command arguments
 // Returns:
-//  1 if the command is executed successfully
-// -1 if there is an error in forking or executing the command
+//  Exit status of the command, 0 if it succeeded
+//  1 if there is an error in forking, 127 if the command could not be executed
 int executeCommand2(char *argsArray[]){
 
     // Fork a child
-    int pid = fork();
-    int status;
+    struct Job *job = createJob(1);
+    if (job == NULL) {
+        last_exit_status = 1;
+        return last_exit_status;
+    }
+    int pid = forkJobProcess(job);
 
     if (pid < 0) {
         printf("Fork failed\n");
-        return -1;
+        freeJob(job);
+        last_exit_status = 1;
+        return last_exit_status;
     }
 
-    if (pid > 0) {
-        // Wait for child to execute
-        waitpid(pid, &status, 0);
-        return 1;
-    } else {
+    if (pid == 0) {
         // execvp returns only if command fails and returns -1
-        int resultOfExec = execvp(argsArray[0], argsArray);
-        if (resultOfExec == -1) {
-            printf("Execution of command failed %s\n",argsArray[0]);
-            return -1;
-        }
+        execvp(argsArray[0], argsArray);
+        printf("Execution of command failed %s\n",argsArray[0]);
+        exitChild(EXIT_COMMAND_NOT_FOUND);
     }
+
+    // Wait for child to execute
+    last_exit_status = waitForegroundJob(job);
+    return last_exit_status;
 }
 
 // Function to execute a command with return status
 // Parameters:
 // - command: String containing the command and its arguments separated by spaces
 // Returns:
-//  1 if the command is executed successfully
-//  -1 if there is an error in parsing the command or executing it
+//  Exit status of the command, 0 if it succeeded
+//  2 if there is an error in parsing the command
 int executeCommandWithReturnStatus(char command[]) {
     int MAX_ARGS=5;
     char *argsArray[MAX_ARGS + 1];
@@ -666,13 +2109,15 @@ int executeCommandWithReturnStatus(char command[]) {
     // Check if the token is not NULL, indicating incorrect number of arguments
     if (token != NULL) {
         printf("Error: Incorrect number of arguments should be >=1 and <=5\n");
-        return -1;
+        last_exit_status = 2;
+        return last_exit_status;
     }
 
     argsArray[argsC] = NULL;
 
     // replace ~ by $HOME ie. user home
     expandHomeDirectory(argsArray);
+    expandExitStatus(argsArray);
 
     // Execute the command and return its status
     return executeCommand2(argsArray);
@@ -712,6 +2157,7 @@ void processAndOr(char input[]) {
     // If number of commands > max commands print error and exit
     if(numCommands>MAX_COMMANDS){
         printf("Maximum of 5 operations / 6 commands are allowed\n");
+        last_exit_status = 2;
         return;
     }
 
@@ -721,6 +2167,8 @@ void processAndOr(char input[]) {
     }
 
     int status = 0; 
+    // Index of the last command that ran, set -e only stops for the last one of the list
+    int lastExecuted = 0;
     // Execute the first command and get its status
     if (numCommands > 0) {
         status = executeCommandWithReturnStatus(commands[0]);
@@ -728,20 +2176,26 @@ void processAndOr(char input[]) {
 
     // Process rest of the commands based on operators and previous command status
     for (int i = 1; i < numCommands; i++) {
-        if (status == 1 && operators[i - 1] == '&') {
+        if (status == 0 && operators[i - 1] == '&') {
             // Execute the command and update status if the previous command succeeded and operator is &&
             status = executeCommandWithReturnStatus(commands[i]);
-        } else if(status!=1 && operators[i-1]=='&'){
+            lastExecuted = i;
+        } else if(status!=0 && operators[i-1]=='&'){
             // Skip the command if the previous command failed and operator is &&
             continue;
-        } else if (status == 1 && operators[i - 1] == '|') {
+        } else if (status == 0 && operators[i - 1] == '|') {
             // Skip the command if the previous command succeeded and operator is ||
             continue;
-        } else if (status != 1 && operators[i - 1] == '|') {
+        } else if (status != 0 && operators[i - 1] == '|') {
             // Execute the command and update status if the previous command failed and operator is ||
             status = executeCommandWithReturnStatus(commands[i]);
+            lastExecuted = i;
         }
     }
+
+    // The status of the list is the status of the last command that ran
+    last_exit_status = status;
+    errexit_ignored = (lastExecuted != numCommands - 1);
 }
 
 // Function to process sequential commands separated by semicolons
@@ -764,6 +2218,7 @@ void processSequentialCommands(char input[]){
     // If number of commands > 5 then print error
     if(numCommands>MAX_COMMANDS){
         printf("Maximum of 5 commands are allowed\n");
+        last_exit_status = 2;
         return;
     }
 
@@ -775,17 +2230,196 @@ void processSequentialCommands(char input[]){
     // Execute each command sequentially
     for(int i=0;i<numCommands;i++){
         executeCommandWithReturnStatus(commands[i]);
+        // set -e skips the rest of the line after a failure
+        if (failureStopsShell()) {
+            break;
+        }
+    }
+
+}
+
+// Default memory cap of a captured job's output
+#define DEFAULT_CAPTURE_LIMIT (256 * 1024)
+#define MAX_CAPTURE_LIMIT (64LL * 1024 * 1024)
+// Bytes a collector reads from a captured job at a time
+#define CAPTURE_READ_SIZE 16384
+
+// Function to parse a size such as "512", "64K", "16M" or "1G" into bytes
+// Returns:
+//  The size, -1 if the text is not a size
+long long parseByteSize(const char *text) {
+    char *suffix;
+    long long size = strtoll(text, &suffix, 10);
+    if (suffix == text) {
+        return -1;
+    }
+    if (*suffix == 'K' || *suffix == 'k') {
+        size *= 1024;
+        suffix++;
+    } else if (*suffix == 'M' || *suffix == 'm') {
+        size *= 1024 * 1024;
+        suffix++;
+    } else if (*suffix == 'G' || *suffix == 'g') {
+        size *= 1024 * 1024 * 1024;
+        suffix++;
+    }
+    return *suffix == '\0' ? size : -1;
+}
+
+// Ring buffer at the start of a captured job's memfd, followed by its data
+// Only the collector process writes; the shell reads. written counts every
+// byte ever captured, so data[written % capacity] is the next byte to write
+// and anything older than written - capacity has been overwritten.
+// The collector raises reserved before it overwrites data, so a reader that
+// copied bytes and then finds them older than reserved - capacity knows that
+// its copy may be torn.
+struct OutputRing {
+    unsigned long long written;
+    unsigned long long reserved;    // written once the copy in progress is done
+    int closed;             // Set once the job has closed its output
+    size_t capacity;
+    char data[];
+};
+
+// Output captured from a background job, kept after the job finishes
+// until another captured job gets the same number
+struct CapturedOutput {
+    int id;                 // Job number, 0 when the slot is free
+    long sequence;          // Sequence of the job when it started
+    char command[MAX_COMMAND_LENGTH];
+    struct OutputRing *ring;
+    size_t mapSize;
+};
+
+struct CapturedOutput captured_outputs[MAX_JOBS];
+int output_capture_enabled = 0;
+long long output_capture_limit = DEFAULT_CAPTURE_LIMIT;
+
+// Function to release the ring buffer of a captured output
+void freeCapturedOutput(struct CapturedOutput *capture) {
+    if (capture->id != 0) {
+        munmap(capture->ring, capture->mapSize);
+        capture->id = 0;
+    }
+}
+
+// Function to copy a collector's input into its ring buffer until end of file
+// Runs in the collector process; the ring is shared with the shell.
+void collectOutput(int inFd, struct OutputRing *ring) {
+    char buffer[CAPTURE_READ_SIZE];
+    ssize_t length;
+    while ((length = read(inFd, buffer, sizeof(buffer))) != 0) {
+        if (length < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        unsigned long long written = ring->written;
+        // Only the last capacity bytes of a large read survive anyway
+        const char *source = buffer;
+        if ((size_t)length > ring->capacity) {
+            written += length - ring->capacity;
+            source += length - ring->capacity;
+            length = ring->capacity;
+        }
+        __atomic_store_n(&ring->reserved, written + length, __ATOMIC_RELAXED);
+        // Publish reserved before any of the data it covers changes
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        size_t offset = written % ring->capacity;
+        size_t first = ring->capacity - offset < (size_t)length ? ring->capacity - offset : (size_t)length;
+        memcpy(ring->data + offset, source, first);
+        memcpy(ring->data, source + first, length - first);
+        __atomic_store_n(&ring->written, written + length, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+}
+
+// Function to start capturing the output of a background job
+// Creates the job's ring buffer in a memfd and forks a collector into the
+// job that copies a pipe into it. The job's command then writes its stdout
+// and stderr to the returned pipe instead of the terminal.
+// Parameters:
+// - job: The background job, before any of its commands are forked
+// Returns:
+//  Write end of the pipe for the command's output, -1 on failure
+int startOutputCapture(struct Job *job) {
+    size_t mapSize = sizeof(struct OutputRing) + output_capture_limit;
+    char name[32];
+    snprintf(name, sizeof(name), "shell24-job-%d", job->id);
+    int memoryFd = memfd_create(name, MFD_CLOEXEC);
+    if (memoryFd == -1) {
+        perror("memfd_create");
+        return -1;
+    }
+    struct OutputRing *ring = MAP_FAILED;
+    if (ftruncate(memoryFd, mapSize) == 0) {
+        ring = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, memoryFd, 0);
+    }
+    // The mapping keeps the memory alive without the descriptor
+    close(memoryFd);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        return -1;
     }
+    ring->capacity = output_capture_limit;
 
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_CLOEXEC) == -1) {
+        perror("pipe");
+        munmap(ring, mapSize);
+        return -1;
+    }
+
+    pid_t pid = forkJobProcess(job);
+    if (pid == -1) {
+        perror("fork");
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        munmap(ring, mapSize);
+        return -1;
+    }
+    if (pid == 0) {
+        // Keep collecting until the command closes its output, even when
+        // the job is killed, so that its last words are not lost
+        signal(SIGTERM, SIG_IGN);
+        close(pipeFds[1]);
+        collectOutput(pipeFds[0], ring);
+        exitChild(0);
+    }
+    close(pipeFds[0]);
+    job->processes[job->numProcesses - 1].helper = 1;
+
+    struct CapturedOutput *capture = &captured_outputs[job->id - 1];
+    freeCapturedOutput(capture);
+    capture->id = job->id;
+    capture->sequence = job->sequence;
+    snprintf(capture->command, sizeof(capture->command), "%s", job->command);
+    capture->ring = ring;
+    capture->mapSize = mapSize;
+    return pipeFds[1];
 }
 
 // Function to execute a command in the background
 // Parameters:
 // - argsArray: Array of strings containing the command and its arguments
 void executeCommandInBackground(char *argsArray[], int isShell){
+    // New shells are not tracked as jobs
+    struct Job *job = NULL;
+    if (isShell != 1 && (job = createJob(0)) == NULL) {
+        return;
+    }
+
+    // Send the job's output to its ring buffer instead of the terminal
+    int outputFd = -1;
+    if (job != NULL && output_capture_enabled && (outputFd = startOutputCapture(job)) == -1) {
+        freeJob(job);
+        last_exit_status = 1;
+        return;
+    }
+
     // Fork new process
-    int pid = fork();
-    int status;
+    int pid = forkJobProcess(job);
 
     if (pid < 0) {
         printf("Fork failed\n");
@@ -794,18 +2428,27 @@ void executeCommandInBackground(char *argsArray[], int isShell){
 
     if (pid > 0) {
        // Parent process
-       // Add child process ID to the background_processes array
+       // The child is recorded in its job by forkJobProcess
        // Don't wait for child - keep it running in background
+       if (outputFd != -1) {
+            close(outputFd);
+       }
        if(isShell!=1){
-            background_processes[background_process_count++] = pid;
+            printf("[%d] %d\n", job->id, pid);
        }
+       // Starting a background command succeeds, its exit status comes later
+       last_exit_status = 0;
     } else {
         // Child process
+        if (outputFd != -1) {
+            dup2(outputFd, STDOUT_FILENO);
+            dup2(outputFd, STDERR_FILENO);
+        }
         // Execute the command
         int resultOfExec = execvp(argsArray[0], argsArray);
         if (resultOfExec == -1) {
             printf("Execution of command failed %s\n",argsArray[0]);
-            exit(1);
+            exitChild(EXIT_COMMAND_NOT_FOUND);
         }
     }
 }
@@ -820,15 +2463,17 @@ void processBackgroundExecution(char input[]){
 
     argsC = 0;
     // Tokenize by space to extract command and its arguments
-    char *token = strtok(input, " ");
+    // '&' is a separator too so that it is not passed as an argument
+    char *token = strtok(input, " &");
     while (token != NULL && argsC < MAX_ARGS) {
         argsArray[argsC++] = token;
-        token = strtok(NULL, " ");
+        token = strtok(NULL, " &");
     }
 
     // Check if more arguments present after tokenization
     if (token != NULL) {
         printf("Error: Incorrect number of arguments should be >=1 and <=5\n");
+        last_exit_status = 2;
         return;
     }
 
@@ -836,28 +2481,20 @@ void processBackgroundExecution(char input[]){
 
     // Replace ~ with $HOME ie. user home
     expandHomeDirectory(argsArray);
+    expandExitStatus(argsArray);
 
     // Execute command in background
     executeCommandInBackground(argsArray,0);
 }
 
-// Function to bring the last background process to the foreground
-void bringLastBackgroundProcessToForeground() {
-    // Function to bring the last background process to the foreground
-    if (background_process_count == 0) {
-        printf("No background processes to bring to foreground\n");
-        return;
-    }
-
-    // Get the PID of the last background process
-    int pid = background_processes[background_process_count - 1];
-    int status;
-
-    // Wait for the background process to finish
-    waitpid(pid, &status, 0);
-
-    // Remove the background process from the list
-    background_process_count--;
+// Function to check whether a command line is a job control builtin
+// kill is only a builtin when given a job, "kill 1234" runs /bin/kill
+// Returns:
+//  1 for "jobs", "fg [%n]", "bg [%n]", "kill %n" and "stop %n", 0 otherwise
+int isJobBuiltin(char input[]) {
+    return strcmp("jobs",input)==0 || strcmp("fg",input)==0 || strncmp("fg ",input,3)==0 ||
+           strcmp("bg",input)==0 || strncmp("bg ",input,3)==0 ||
+           strncmp("kill %",input,6)==0 || strncmp("stop %",input,6)==0;
 }
 
 // Function to start a new shell in the background
@@ -869,90 +2506,2391 @@ void startNewShell(){
     executeCommandInBackground(args,1);
 }
 
-int main() {
-    // get user input in an array
-    char input[MAX_COMMAND_LENGTH];
+// Default size limit of the command output cache, override with SHELL24_CACHE_LIMIT
+#define DEFAULT_CACHE_LIMIT (64 * 1024 * 1024)
+// Magic number at the start of every cache entry
+#define CACHE_ENTRY_MAGIC 0x43343253
+// Environment variables that can change the output of a cached command
+const char *cache_key_environment[] = {"PATH", "HOME", "LANG", "LC_ALL", "TZ", NULL};
+
+// Header stored in front of the output in every cache entry
+struct CacheEntryHeader {
+    unsigned int magic;
+    int exitStatus;
+};
+
+// Counters reported by "cache stats" for this session
+long cache_hits = 0;
+long cache_misses = 0;
+long cache_evictions = 0;
+
+// Function to mix bytes into a 64-bit FNV-1a hash
+// Parameters:
+// - hash: The hash so far
+// - data: Bytes to add
+// - length: Number of bytes
+// Returns:
+//  The updated hash
+unsigned long long hashBytes(unsigned long long hash, const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
 
-    // infinite loop for shell
-    while (1) {
-        // print shell prompt and wait for user input
-        printf("shell24$ ");
+// Function to mix the identity of a file into a cache key
+// Size, modification time and inode change whenever the file is rewritten.
+// Parameters:
+// - hash: The hash so far
+// - path: The file, ignored if it does not exist or is not a regular file
+// Returns:
+//  The updated hash
+unsigned long long hashFileIdentity(unsigned long long hash, const char *path) {
+    struct stat fileStat;
+    if (stat(path, &fileStat) == -1 || !S_ISREG(fileStat.st_mode)) {
+        return hash;
+    }
+    hash = hashBytes(hash, path, strlen(path) + 1);
+    hash = hashBytes(hash, &fileStat.st_dev, sizeof(fileStat.st_dev));
+    hash = hashBytes(hash, &fileStat.st_ino, sizeof(fileStat.st_ino));
+    hash = hashBytes(hash, &fileStat.st_size, sizeof(fileStat.st_size));
+    hash = hashBytes(hash, &fileStat.st_mtim, sizeof(fileStat.st_mtim));
+    return hash;
+}
 
-        // take user input
-        fgets(input, sizeof(input), stdin);
+// Function to compute the cache key of a command
+// Parameters:
+// - argsArray: The command and its arguments
+// - inputFile: File named in a "<" redirection, NULL if none
+// Returns:
+//  64-bit key covering argv, working directory, environment and input files
+unsigned long long computeCacheKey(char *argsArray[], char *inputFile) {
+    unsigned long long hash = 14695981039346656037ULL;
 
-        // Remove trailing newline character
-        if (input[strlen(input) - 1] == '\n') {
-            input[strlen(input) - 1] = '\0';
+    for (int i = 0; argsArray[i] != NULL; i++) {
+        hash = hashBytes(hash, argsArray[i], strlen(argsArray[i]) + 1);
+    }
+
+    // Relative paths in arguments depend on the working directory
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        hash = hashBytes(hash, cwd, strlen(cwd) + 1);
+    }
+
+    for (int i = 0; cache_key_environment[i] != NULL; i++) {
+        char *value = getenv(cache_key_environment[i]);
+        hash = hashBytes(hash, cache_key_environment[i], strlen(cache_key_environment[i]) + 1);
+        if (value != NULL) {
+            hash = hashBytes(hash, value, strlen(value) + 1);
         }
+    }
 
-        // Flags to identify the type of command
-        int concatenate = 0; // File concatenation
-        int piping = 0;  // Pipe operation
-        int redirect = 0; // Input/Ouput redirection
-        int and_or=0; // && and || 
-        int sequential=0; // ; Sequential execution
-        int backgroundProcess=0; // Execute in background
-
-        // Traverse through input
-        for (int i = 0; i < strlen(input); i++) {
-            if (input[i] == '|') {
-                // if double '|' then it is OR
-                if(i+1<strlen(input) && input[i+1]=='|'){
-                    and_or=1;
-                }else if(i-1>0 && input[i-1]=='|'){
-                    and_or=1; 
-                }else{
-                    // Single '|' means pipe
-                    piping = 1;
-                }
-            } else if (input[i] == '#') {
-                // # means file concatenation
-                concatenate = 1;
-            } else if (input[i] == '>' || input[i] == '<') {
-                // if > or < or >> it means input/output redirection
-                redirect = 1;
-            } else if(input[i]=='&'){
-                // Double '&' means AND
-                 if(i+1<strlen(input) && input[i+1]=='&'){
-                    and_or=1;
-                }else if(i-1>0 && input[i-1]=='&'){
-                    and_or=1; 
-                }else{
-                    // Single '&' means run in background
-                    backgroundProcess = 1;
-                }
-            }else if(input[i]==';'){
-                // ; means run sequentially
-                sequential=1;
+    // Any argument naming an existing file is treated as an input
+    for (int i = 1; argsArray[i] != NULL; i++) {
+        hash = hashFileIdentity(hash, argsArray[i]);
+    }
+    if (inputFile != NULL) {
+        hash = hashBytes(hash, "<", 1);
+        hash = hashFileIdentity(hash, inputFile);
+    }
+    return hash;
+}
+
+// Function to get the cache directory, creating it if needed
+// Uses $SHELL24_CACHE_DIR, or ~/.cache/shell24 by default
+// Parameters:
+// - directory: Buffer receiving the path
+// - size: Size of the buffer
+// Returns:
+//  0 on success, -1 if the directory could not be created
+int getCacheDirectory(char directory[], size_t size) {
+    char *configured = getenv("SHELL24_CACHE_DIR");
+    if (configured != NULL) {
+        snprintf(directory, size, "%s", configured);
+    } else {
+        char *homeDir = getenv("HOME");
+        if (homeDir == NULL) {
+            printf("Error: HOME environment variable not set\n");
+            return -1;
+        }
+        snprintf(directory, size, "%s/.cache", homeDir);
+        mkdir(directory, 0755);
+        snprintf(directory, size, "%s/.cache/shell24", homeDir);
+    }
+
+    if (mkdir(directory, 0755) == -1 && errno != EEXIST) {
+        perror("Error creating cache directory");
+        return -1;
+    }
+    return 0;
+}
+
+// Function to get the cache size limit in bytes
+// $SHELL24_CACHE_LIMIT accepts a number of bytes with an optional K, M or G suffix
+long long getCacheLimit() {
+    char *configured = getenv("SHELL24_CACHE_LIMIT");
+    if (configured == NULL) {
+        return DEFAULT_CACHE_LIMIT;
+    }
+
+    long long limit = parseByteSize(configured);
+    return limit > 0 ? limit : DEFAULT_CACHE_LIMIT;
+}
+
+// A cache entry found while scanning the cache directory
+struct CacheFile {
+    char name[32];
+    long long size;
+    time_t lastUsed;
+};
+
+// Function to order cache files from least to most recently used
+int compareCacheFiles(const void *a, const void *b) {
+    const struct CacheFile *first = a;
+    const struct CacheFile *second = b;
+    if (first->lastUsed != second->lastUsed) {
+        return first->lastUsed < second->lastUsed ? -1 : 1;
+    }
+    return strcmp(first->name, second->name);
+}
+
+// Function to scan the cache directory and evict entries above a size limit
+// Least recently used entries are removed first; hits refresh an entry's mtime.
+// Parameters:
+// - directory: The cache directory
+// - limit: Maximum total size in bytes, -1 to only count
+// - totalEntries: Filled with the number of entries left
+// - totalSize: Filled with the size of the entries left
+void scanCacheDirectory(char directory[], long long limit, int *totalEntries, long long *totalSize) {
+    *totalEntries = 0;
+    *totalSize = 0;
+
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        return;
+    }
+
+    int capacity = 64;
+    struct CacheFile *files = malloc(capacity * sizeof(struct CacheFile));
+    if (files == NULL) {
+        closedir(dir);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // Remove entries left half-written by shells that have since exited
+        char *tempSuffix = strstr(entry->d_name, ".out.tmp.");
+        if (tempSuffix != NULL) {
+            pid_t writer = atoi(tempSuffix + 9);
+            if (writer > 0 && writer != getpid() && kill(writer, 0) == -1 && errno == ESRCH) {
+                unlinkat(dirfd(dir), entry->d_name, 0);
             }
+            continue;
         }
 
-        // if newt it means open a new shell
-        if(strcmp("newt",input)==0){
-            startNewShell();
+        size_t nameLength = strlen(entry->d_name);
+        if (nameLength < 5 || nameLength >= sizeof(files[0].name) ||
+            strcmp(entry->d_name + nameLength - 4, ".out") != 0) {
+            continue;
         }
-        // bring last background process to foreground
-        else if(strcmp("fg",input)==0){
-            bringLastBackgroundProcessToForeground();
+
+        struct stat fileStat;
+        if (fstatat(dirfd(dir), entry->d_name, &fileStat, 0) == -1) {
+            continue;
         }
-        // Execute functions based on their type of input
-        else if(concatenate==1){
-            processFileConcatenation(input);
-        }else if(piping==1){
-            processPipeOperation(input);
-        }else if(redirect==1){
-            processRedirection(input);
-        }else if(and_or==1){
-            processAndOr(input);
-        }else if(sequential==1){
-            processSequentialCommands(input);
-        }else if(backgroundProcess==1){
-            processBackgroundExecution(input);
+
+        if (*totalEntries == capacity) {
+            struct CacheFile *grown = realloc(files, 2 * capacity * sizeof(struct CacheFile));
+            if (grown == NULL) {
+                break;
+            }
+            files = grown;
+            capacity *= 2;
         }
-        else{
-            processNormalCommand(input);
+        struct CacheFile *file = &files[(*totalEntries)++];
+        strcpy(file->name, entry->d_name);
+        file->size = fileStat.st_size;
+        file->lastUsed = fileStat.st_mtime;
+        *totalSize += fileStat.st_size;
+    }
+
+    if (limit >= 0 && *totalSize > limit) {
+        qsort(files, *totalEntries, sizeof(struct CacheFile), compareCacheFiles);
+        int removed = 0;
+        while (removed < *totalEntries && *totalSize > limit) {
+            if (unlinkat(dirfd(dir), files[removed].name, 0) == 0) {
+                *totalSize -= files[removed].size;
+                cache_evictions++;
+            }
+            removed++;
         }
+        *totalEntries -= removed;
     }
-    return 0;
-}
\ No newline at end of file
+
+    free(files);
+    closedir(dir);
+}
+
+// Function to copy a stored output to stdout with sendfile
+// Parameters:
+// - fd: The cache entry, positioned anywhere
+// - offset: Where the output starts in the entry
+// - length: Number of bytes of output
+void replayCachedOutput(int fd, off_t offset, off_t length) {
+    fflush(stdout);
+    while (length > 0) {
+        ssize_t sent = sendfile(STDOUT_FILENO, fd, &offset, length);
+        if (sent > 0) {
+            length -= sent;
+            continue;
+        }
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent == -1 && (errno == EINVAL || errno == ENOSYS)) {
+            // stdout does not support sendfile, fall back to read/write
+            char buffer[8192];
+            ssize_t bytesRead = pread(fd, buffer, length < (off_t)sizeof(buffer) ? length : (off_t)sizeof(buffer), offset);
+            if (bytesRead > 0 && write(STDOUT_FILENO, buffer, bytesRead) == bytesRead) {
+                offset += bytesRead;
+                length -= bytesRead;
+                continue;
+            }
+        }
+        perror("Error replaying cached output");
+        return;
+    }
+}
+
+// Function to run a command and store its output in a new cache entry
+// The output is shown while it is produced and written to a temporary
+// file which becomes the entry once the command has exited.
+// Parameters:
+// - argsArray: The command and its arguments
+// - inputFile: File to use as stdin, NULL to keep the shell's stdin
+// - entryPath: Final path of the cache entry
+// Returns:
+//  Exit status of the command, -1 if it could not be run
+int runAndCacheCommand(char *argsArray[], char *inputFile, char entryPath[]) {
+    char tempPath[PATH_MAX + 32];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp.%d", entryPath, getpid());
+    int entryFd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (entryFd == -1) {
+        perror("Error creating cache entry");
+        return -1;
+    }
+
+    // Without a < file the command reads /dev/null rather than the shell's
+    // stdin, which is not part of the cache key
+    int inputFd = open(inputFile != NULL ? inputFile : "/dev/null", O_RDONLY | O_CLOEXEC);
+    if (inputFd == -1) {
+        perror("Error opening input file");
+        close(entryFd);
+        unlink(tempPath);
+        return -1;
+    }
+
+    int outputPipe[2];
+    if (pipe2(outputPipe, O_CLOEXEC) == -1) {
+        perror("Pipe creation failed");
+        close(entryFd);
+        unlink(tempPath);
+        close(inputFd);
+        return -1;
+    }
+
+    int pid = forkJobProcess(NULL);
+    if (pid < 0) {
+        printf("Fork failed\n");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        // Child process writes to the pipe and reads the input file or /dev/null
+        // The shell is busy copying its output, so it cannot be suspended
+        signal(SIGTSTP, SIG_IGN);
+        if (dup2(outputPipe[1], STDOUT_FILENO) == -1 || dup2(inputFd, STDIN_FILENO) == -1) {
+            perror("Dup2 failed");
+            exitChild(EXIT_FAILURE);
+        }
+        if (execvp(argsArray[0], argsArray) == -1) {
+            printf("Execution of command failed %s\n",argsArray[0]);
+            exitChild(EXIT_COMMAND_NOT_FOUND);
+        }
+    }
+
+    close(outputPipe[1]);
+    close(inputFd);
+
+    // Leave room for the header, written once the exit status is known
+    struct CacheEntryHeader header = {CACHE_ENTRY_MAGIC, 0};
+    int storeFailed = (write(entryFd, &header, sizeof(header)) != sizeof(header));
+
+    char buffer[8192];
+    ssize_t bytesRead;
+    while ((bytesRead = read(outputPipe[0], buffer, sizeof(buffer))) != 0) {
+        if (bytesRead == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (write(STDOUT_FILENO, buffer, bytesRead) != bytesRead) {
+            storeFailed = 1;
+        }
+        if (!storeFailed && write(entryFd, buffer, bytesRead) != bytesRead) {
+            storeFailed = 1;
+        }
+    }
+    close(outputPipe[0]);
+
+    int status;
+    waitForegroundProcess(pid, &status, 0);
+
+    // Commands killed by a signal did not produce their full output, and a
+    // command that could not be executed may work once it is installed
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == EXIT_COMMAND_NOT_FOUND) {
+        storeFailed = 1;
+    }
+    header.exitStatus = decodeWaitStatus(status);
+    if (!storeFailed && pwrite(entryFd, &header, sizeof(header), 0) != sizeof(header)) {
+        storeFailed = 1;
+    }
+    close(entryFd);
+
+    if (storeFailed || rename(tempPath, entryPath) == -1) {
+        unlink(tempPath);
+    }
+    return header.exitStatus;
+}
+
+// Function to process a command prefixed with "cached"
+// The command's stdout and exit status are stored on disk keyed by its
+// arguments, environment and the identity of its input files. Running it
+// again with the same key replays the stored output instead.
+// Parameters:
+// - input: The command after the "cached" prefix, optionally with "< file"
+// Example:
+//   processCachedCommand("sort -u < big.txt")
+void processCachedCommand(char input[]){
+    // Only a single command with an optional input file can be cached
+    if (strpbrk(input, "|>&;#") != NULL) {
+        printf("Error: cached supports a single command with an optional < input file\n");
+        last_exit_status = 2;
+        return;
+    }
+
+    char *inputFile = NULL;
+    char *redirection = strchr(input, '<');
+    if (redirection != NULL) {
+        *redirection = '\0';
+        inputFile = redirection + 1;
+        trimWhitespace(inputFile);
+        if (inputFile[0] == '\0' || strchr(inputFile, '<') != NULL) {
+            printf("Error: Invalid input redirection\n");
+            last_exit_status = 2;
+            return;
+        }
+    }
+
+    int MAX_ARGS=5;
+    char *argsArray[MAX_ARGS + 1];
+    int argsC;
+
+    argsC = 0;
+    // Tokenize input based on spaces to get command and its arguments
+    char *token = strtok(input, " ");
+    while (token != NULL && argsC < MAX_ARGS) {
+        argsArray[argsC++] = token;
+        token = strtok(NULL, " ");
+    }
+
+    // Check if more arguments present after tokenization limit
+    if (token != NULL || argsC == 0) {
+        printf("Error: Incorrect number of arguments should be >=1 and <=5\n");
+        last_exit_status = 2;
+        return;
+    }
+
+    argsArray[argsC] = NULL;
+
+    // Replace ~ with $HOME in the command and the input file
+    expandHomeDirectory(argsArray);
+    expandExitStatus(argsArray);
+    if (inputFile != NULL) {
+        char *inputArray[2] = {inputFile, NULL};
+        expandHomeDirectory(inputArray);
+        expandExitStatus(inputArray);
+        inputFile = inputArray[0];
+    }
+
+    char directory[PATH_MAX];
+    if (getCacheDirectory(directory, sizeof(directory)) == -1) {
+        return;
+    }
+
+    char entryPath[PATH_MAX + 32];
+    snprintf(entryPath, sizeof(entryPath), "%s/%016llx.out", directory, computeCacheKey(argsArray, inputFile));
+
+    // Replay the stored output on a hit
+    int entryFd = open(entryPath, O_RDONLY | O_CLOEXEC);
+    if (entryFd != -1) {
+        struct CacheEntryHeader header;
+        struct stat entryStat;
+        if (pread(entryFd, &header, sizeof(header), 0) == sizeof(header) &&
+            header.magic == CACHE_ENTRY_MAGIC && fstat(entryFd, &entryStat) == 0) {
+            cache_hits++;
+            // Refresh the entry so eviction sees it as recently used
+            futimens(entryFd, NULL);
+            replayCachedOutput(entryFd, sizeof(header), entryStat.st_size - sizeof(header));
+            last_exit_status = header.exitStatus;
+            close(entryFd);
+            return;
+        }
+        close(entryFd);
+    }
+
+    cache_misses++;
+    int exitStatus = runAndCacheCommand(argsArray, inputFile, entryPath);
+    if (exitStatus != -1) {
+        last_exit_status = exitStatus;
+        int totalEntries;
+        long long totalSize;
+        scanCacheDirectory(directory, getCacheLimit(), &totalEntries, &totalSize);
+    }
+}
+
+// Function to process the "cache" builtin
+// Parameters:
+// - input: "cache stats" or "cache clear"
+void processCacheBuiltin(char input[]){
+    char directory[PATH_MAX];
+    if (getCacheDirectory(directory, sizeof(directory)) == -1) {
+        return;
+    }
+
+    int totalEntries;
+    long long totalSize;
+    if (strcmp(input, "cache stats") == 0) {
+        scanCacheDirectory(directory, -1, &totalEntries, &totalSize);
+        long lookups = cache_hits + cache_misses;
+        printf("Cache directory: %s\n", directory);
+        printf("Hits: %ld  Misses: %ld  Hit rate: %.1f%%\n", cache_hits, cache_misses,
+               lookups > 0 ? 100.0 * cache_hits / lookups : 0.0);
+        printf("Entries: %d  Size: %lld bytes  Limit: %lld bytes  Evictions: %ld\n",
+               totalEntries, totalSize, getCacheLimit(), cache_evictions);
+    } else if (strcmp(input, "cache clear") == 0) {
+        scanCacheDirectory(directory, 0, &totalEntries, &totalSize);
+    } else {
+        printf("Usage: cache stats | cache clear\n");
+        last_exit_status = 2;
+    }
+}
+
+int processCommandLine(char input[]);
+
+// Maximum depth of nested source commands
+#define MAX_SOURCE_DEPTH 16
+// Maximum number of sourced files whose lines are kept in memory
+#define MAX_SOURCE_CACHE 32
+
+// The command lines of a sourced file, valid while the file is unchanged
+struct SourceCacheEntry {
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+    char **lines;           // Trimmed command lines, without blanks and comments
+    int numLines;
+    int inUse;              // Number of source commands running these lines
+    long lastUsed;
+};
+
+struct SourceCacheEntry source_cache[MAX_SOURCE_CACHE];
+int source_cache_count = 0;
+long source_cache_clock = 0;
+// Number of source commands currently running
+int source_depth = 0;
+
+// Function to find the cached lines of a file
+// Parameters:
+// - fileStat: stat of the open file
+// Returns:
+//  The entry if the file was parsed before and has not changed since, NULL otherwise
+struct SourceCacheEntry *findSourceCache(struct stat *fileStat) {
+    for (int i = 0; i < source_cache_count; i++) {
+        struct SourceCacheEntry *entry = &source_cache[i];
+        if (entry->device == fileStat->st_dev && entry->inode == fileStat->st_ino &&
+            entry->size == fileStat->st_size &&
+            entry->modified.tv_sec == fileStat->st_mtim.tv_sec &&
+            entry->modified.tv_nsec == fileStat->st_mtim.tv_nsec) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Function to free the lines of a cached file
+void freeSourceLines(char **lines, int numLines) {
+    for (int i = 0; i < numLines; i++) {
+        free(lines[i]);
+    }
+    free(lines);
+}
+
+// Function to store the command lines of a file in the cache
+// A stale entry for the same file, or else the least recently used entry
+// that is not running, is replaced. The lines are freed if nothing can be.
+// Parameters:
+// - fileStat: stat of the file taken when it was opened
+// - lines: Parsed lines, owned by the cache afterwards
+// - numLines: Number of lines
+void storeSourceCache(struct stat *fileStat, char **lines, int numLines) {
+    struct SourceCacheEntry *slot = NULL;
+    if (source_cache_count < MAX_SOURCE_CACHE) {
+        slot = &source_cache[source_cache_count++];
+    } else {
+        for (int i = 0; i < MAX_SOURCE_CACHE; i++) {
+            struct SourceCacheEntry *entry = &source_cache[i];
+            if (entry->inUse > 0) {
+                continue;
+            }
+            if (entry->device == fileStat->st_dev && entry->inode == fileStat->st_ino) {
+                slot = entry;
+                break;
+            }
+            if (slot == NULL || entry->lastUsed < slot->lastUsed) {
+                slot = entry;
+            }
+        }
+        if (slot == NULL) {
+            freeSourceLines(lines, numLines);
+            return;
+        }
+        freeSourceLines(slot->lines, slot->numLines);
+    }
+
+    slot->device = fileStat->st_dev;
+    slot->inode = fileStat->st_ino;
+    slot->size = fileStat->st_size;
+    slot->modified = fileStat->st_mtim;
+    slot->lines = lines;
+    slot->numLines = numLines;
+    slot->inUse = 0;
+    slot->lastUsed = ++source_cache_clock;
+}
+
+// Function to run one line of a sourced file
+// The arena is rewound afterwards so long scripts do not grow memory.
+// Parameters:
+// - line: The command line, left unmodified
+void runSourcedLine(char *line) {
+    char input[MAX_COMMAND_LENGTH];
+    snprintf(input, sizeof(input), "%s", line);
+
+    struct ArenaMark mark = arenaMark();
+    processCommandLine(input);
+    arenaRelease(mark);
+}
+
+// Function to run a file's command lines inside the running shell
+// The whole file is read before any line runs, so that nothing a line does
+// can move the file offset under the reader, and the lines are kept so that
+// sourcing the same unchanged file again skips reading it.
+// Parameters:
+// - path: The file to run
+// Example:
+//   sourceFile("~/helpers.sh")
+void sourceFile(char *path) {
+    if (source_depth >= MAX_SOURCE_DEPTH) {
+        printf("Error: source nested too deeply (up to %d levels)\n", MAX_SOURCE_DEPTH);
+        last_exit_status = 1;
+        return;
+    }
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        last_exit_status = 1;
+        return;
+    }
+    struct stat fileStat;
+    if (fstat(fileno(file), &fileStat) == -1) {
+        perror(path);
+        fclose(file);
+        last_exit_status = 1;
+        return;
+    }
+
+    last_exit_status = 0;
+    source_depth++;
+
+    struct SourceCacheEntry *entry = findSourceCache(&fileStat);
+    if (entry != NULL) {
+        fclose(file);
+        entry->lastUsed = ++source_cache_clock;
+        // Keep the entry from being replaced by nested source commands
+        entry->inUse++;
+        for (int i = 0; i < entry->numLines && !failureStopsShell(); i++) {
+            runSourcedLine(entry->lines[i]);
+        }
+        entry->inUse--;
+        source_depth--;
+        return;
+    }
+
+    char **lines = NULL;
+    int numLines = 0;
+    int capacity = 0;
+    int readFailed = 0;
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t lineLength;
+    int lineNumber = 0;
+    while ((lineLength = getline(&line, &lineCapacity, file)) != -1) {
+        lineNumber++;
+        trimWhitespace(line);
+        // Skip blank lines and comments
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        if (strlen(line) >= MAX_COMMAND_LENGTH) {
+            printf("Error: %s line %d is longer than %d characters\n", path, lineNumber, MAX_COMMAND_LENGTH - 1);
+            continue;
+        }
+
+        if (numLines == capacity) {
+            capacity = capacity ? 2 * capacity : 16;
+            char **grown = realloc(lines, capacity * sizeof(char *));
+            if (grown == NULL) {
+                readFailed = 1;
+                break;
+            }
+            lines = grown;
+        }
+        if ((lines[numLines] = strdup(line)) == NULL) {
+            readFailed = 1;
+            break;
+        }
+        numLines++;
+    }
+    free(line);
+    fclose(file);
+
+    if (readFailed) {
+        printf("Error: Memory allocation failed\n");
+        freeSourceLines(lines, numLines);
+        last_exit_status = 1;
+        source_depth--;
+        return;
+    }
+
+    // set -e stops the file at the first failure
+    for (int i = 0; i < numLines && !failureStopsShell(); i++) {
+        runSourcedLine(lines[i]);
+    }
+    storeSourceCache(&fileStat, lines, numLines);
+    source_depth--;
+}
+
+// Function to process the "source file" and ". file" builtins
+// Parameters:
+// - input: The command line
+void processSourceBuiltin(char input[]) {
+    char *argsArray[3];
+    strtok(input, " ");
+    argsArray[0] = strtok(NULL, " ");
+    argsArray[1] = NULL;
+    if (argsArray[0] == NULL || strtok(NULL, " ") != NULL) {
+        printf("Usage: source file\n");
+        last_exit_status = 2;
+        return;
+    }
+
+    // Replace ~ with $HOME in the file name
+    expandHomeDirectory(argsArray);
+    sourceFile(argsArray[0]);
+}
+
+// Time without further changes before watch re-runs its command
+#define WATCH_DEBOUNCE_MS 200
+// Maximum number of paths watch can follow
+#define MAX_WATCH_PATHS 8
+
+// Set by the SIGINT handler of builtins that run until Ctrl-C
+volatile sig_atomic_t interrupt_requested = 0;
+
+// Function to note a Ctrl-C for builtins that run until interrupted
+void handleInterrupt(int signalNumber) {
+    (void)signalNumber;
+    interrupt_requested = 1;
+}
+
+// Function to make Ctrl-C interrupt a long running builtin instead of the shell
+// No SA_RESTART, so blocking calls such as poll return EINTR.
+// Parameters:
+// - previous: Filled with the handler to restore afterwards
+void catchInterrupts(struct sigaction *previous) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleInterrupt;
+    sigemptyset(&action.sa_mask);
+    interrupt_requested = 0;
+    sigaction(SIGINT, &action, previous);
+}
+
+// Function to find the files a command reads through "<" and "#"
+// Parameters:
+// - command: Copy of the command line, modified
+// - paths: Filled with the file names
+// Returns:
+//  Number of files found
+// Example:
+//   "sort < data.txt" gives {"data.txt"}, "a.txt # b.txt" gives {"a.txt", "b.txt"}
+int detectWatchPaths(char command[], char *paths[]) {
+    int numPaths = 0;
+
+    if (strchr(command, '#') != NULL) {
+        char *token = strtok(command, " # ");
+        while (token != NULL && numPaths < MAX_WATCH_PATHS) {
+            paths[numPaths++] = token;
+            token = strtok(NULL, " # ");
+        }
+        return numPaths;
+    }
+
+    char *redirection = strchr(command, '<');
+    if (redirection != NULL && redirection[1] != '(') {
+        char *file = strtok(redirection + 1, " |>&;");
+        if (file != NULL) {
+            paths[numPaths++] = file;
+        }
+    }
+    return numPaths;
+}
+
+// Function to start the command of a watch
+// The command runs in its own process group with stdin from /dev/null so
+// that it can be cancelled as a whole and never competes for the terminal.
+// Parameters:
+// - command: The command line to run
+// Returns:
+//  Process ID of the run
+pid_t startWatchRun(char command[]) {
+    pid_t pid = forkJobProcess(NULL);
+    if (pid < 0) {
+        perror("Fork failed");
+        return -1;
+    }
+    if (pid == 0) {
+        setpgid(0, 0);
+        int devNull = open("/dev/null", O_RDONLY);
+        if (devNull != -1) {
+            dup2(devNull, STDIN_FILENO);
+            close(devNull);
+        }
+        char input[MAX_COMMAND_LENGTH];
+        snprintf(input, sizeof(input), "%s", command);
+        processCommandLine(input);
+        exitChild(last_exit_status);
+    }
+    setpgid(pid, pid);
+    return pid;
+}
+
+// Function to cancel a running watch command and everything it started
+void cancelWatchRun(pid_t pid) {
+    kill(-pid, SIGTERM);
+    kill(-pid, SIGCONT);
+    waitpid(pid, NULL, 0);
+}
+
+// Function to process the watch builtin
+// Runs the command, then waits for inotify events on the watched paths and
+// re-runs it once no change has arrived for WATCH_DEBOUNCE_MS. A run still
+// in progress when new changes arrive is cancelled. Ctrl-C ends the watch.
+// Parameters:
+// - input: "watch [-p path... --] command"
+// Example:
+//   processWatchBuiltin("watch -p report.csv -- sort -n report.csv")
+//   processWatchBuiltin("watch wc -l < data.txt")
+void processWatchBuiltin(char input[]) {
+    char *paths[MAX_WATCH_PATHS + 1];
+    int numPaths = 0;
+    char *command = input + 5;
+    while (*command == ' ') {
+        command++;
+    }
+
+    if (strncmp(command, "-p ", 3) == 0) {
+        // Explicit paths up to "--"
+        char *separator = strstr(command, " -- ");
+        if (separator == NULL) {
+            printf("Usage: watch [-p path... --] command\n");
+            last_exit_status = 2;
+            return;
+        }
+        *separator = '\0';
+        char *token = strtok(command + 3, " ");
+        while (token != NULL && numPaths < MAX_WATCH_PATHS) {
+            paths[numPaths++] = token;
+            token = strtok(NULL, " ");
+        }
+        if (token != NULL) {
+            printf("Error: Too many paths to watch (up to %d allowed)\n", MAX_WATCH_PATHS);
+            last_exit_status = 2;
+            return;
+        }
+        command = separator + 4;
+    } else {
+        // Paths from the command's "<" and "#" operands
+        char *copy = arenaAlloc(strlen(command) + 1);
+        if (copy == NULL) {
+            printf("Error: Memory allocation failed\n");
+            last_exit_status = 1;
+            return;
+        }
+        strcpy(copy, command);
+        numPaths = detectWatchPaths(copy, paths);
+    }
+    trimWhitespace(command);
+    if (numPaths == 0 || command[0] == '\0') {
+        printf("Usage: watch [-p path... --] command\n");
+        last_exit_status = 2;
+        return;
+    }
+    paths[numPaths] = NULL;
+
+    // Replace ~ with $HOME in paths
+    expandHomeDirectory(paths);
+
+    int inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd == -1) {
+        perror("inotify failed");
+        return;
+    }
+    // Watch descriptor of each path, -1 while the path cannot be watched
+    int watchDescriptors[MAX_WATCH_PATHS];
+    const unsigned int watchEvents = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+    for (int i = 0; i < numPaths; i++) {
+        watchDescriptors[i] = inotify_add_watch(inotifyFd, paths[i], watchEvents);
+        if (watchDescriptors[i] == -1) {
+            perror(paths[i]);
+            close(inotifyFd);
+            return;
+        }
+    }
+
+    struct sigaction previousAction;
+    catchInterrupts(&previousAction);
+
+    printf("Watching %d path(s), Ctrl-C to stop\n", numPaths);
+    pid_t running = startWatchRun(command);
+    int changePending = 0;
+    long long lastChange = 0;
+
+    while (!interrupt_requested) {
+        // Sleep until a change, the end of the debounce delay or a check on the run
+        int timeout = -1;
+        if (changePending) {
+            long long remaining = WATCH_DEBOUNCE_MS - (monotonicMicroseconds() - lastChange) / 1000;
+            timeout = remaining > 0 ? remaining : 0;
+        } else if (running > 0) {
+            timeout = 100;
+        }
+
+        struct pollfd pollFd = {inotifyFd, POLLIN, 0};
+        int ready = poll(&pollFd, 1, timeout);
+        if (ready == -1 && errno != EINTR) {
+            perror("Poll failed");
+            break;
+        }
+
+        if (ready > 0) {
+            char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            ssize_t length;
+            while ((length = read(inotifyFd, events, sizeof(events))) > 0) {
+                for (char *event = events; event < events + length;
+                     event += sizeof(struct inotify_event) + ((struct inotify_event *)event)->len) {
+                    struct inotify_event *inotifyEvent = (struct inotify_event *)event;
+                    // A replaced or deleted file has to be watched again
+                    if (inotifyEvent->mask & (IN_IGNORED | IN_MOVE_SELF | IN_DELETE_SELF)) {
+                        for (int i = 0; i < numPaths; i++) {
+                            if (watchDescriptors[i] == inotifyEvent->wd) {
+                                inotify_rm_watch(inotifyFd, watchDescriptors[i]);
+                                watchDescriptors[i] = -1;
+                            }
+                        }
+                    }
+                }
+            }
+            changePending = 1;
+            lastChange = monotonicMicroseconds();
+        }
+
+        if (running > 0) {
+            int status;
+            if (waitpid(running, &status, WNOHANG) == running) {
+                running = 0;
+                printf("watch: exit status %d, waiting for changes\n", decodeWaitStatus(status));
+                fflush(stdout);
+            }
+        }
+
+        if (changePending && monotonicMicroseconds() - lastChange >= WATCH_DEBOUNCE_MS * 1000LL) {
+            changePending = 0;
+            for (int i = 0; i < numPaths; i++) {
+                if (watchDescriptors[i] == -1) {
+                    watchDescriptors[i] = inotify_add_watch(inotifyFd, paths[i], watchEvents);
+                }
+            }
+            if (running > 0) {
+                cancelWatchRun(running);
+                printf("watch: cancelled outdated run\n");
+            }
+            running = startWatchRun(command);
+        }
+    }
+
+    if (running > 0) {
+        cancelWatchRun(running);
+    }
+    sigaction(SIGINT, &previousAction, NULL);
+    close(inotifyFd);
+    printf("\n");
+}
+
+// Position of a reader in a captured output
+struct CaptureCursor {
+    unsigned long long position;    // Count of bytes already read
+    unsigned long long dropped;     // Bytes skipped since the last dropped report
+    int resync;                     // Skipping the rest of a line cut by a drop
+    int midLine;                    // The last byte written was not a newline
+};
+
+// Function to report bytes of a captured output that were skipped
+void reportDroppedOutput(struct CaptureCursor *cursor) {
+    printf("%s[... %llu bytes dropped]\n", cursor->midLine ? "\n" : "", cursor->dropped);
+    fflush(stdout);
+    cursor->dropped = 0;
+    cursor->midLine = 0;
+}
+
+// Function to write the part of a captured output after a reader's position
+// Bytes are copied out of the ring before they are written, and the copy is
+// only used if the collector did not overwrite them meanwhile. Bytes that
+// were overwritten before they could be read, and the rest of the line they
+// cut, are skipped and reported as dropped.
+// Parameters:
+// - ring: The captured output
+// - cursor: Position of the reader, advanced past the bytes written
+void writeCapturedOutput(struct OutputRing *ring, struct CaptureCursor *cursor) {
+    char buffer[CAPTURE_READ_SIZE];
+    fflush(stdout);
+    while (1) {
+        unsigned long long written = __atomic_load_n(&ring->written, __ATOMIC_ACQUIRE);
+        unsigned long long reserved = __atomic_load_n(&ring->reserved, __ATOMIC_ACQUIRE);
+        if (reserved - cursor->position > ring->capacity) {
+            cursor->dropped += reserved - ring->capacity - cursor->position;
+            cursor->position = reserved - ring->capacity;
+            cursor->resync = 1;
+        }
+        if (cursor->position >= written) {
+            if (cursor->dropped > 0) {
+                reportDroppedOutput(cursor);
+            }
+            return;
+        }
+
+        size_t offset = cursor->position % ring->capacity;
+        size_t length = ring->capacity - offset;
+        if (length > written - cursor->position) {
+            length = written - cursor->position;
+        }
+        if (length > sizeof(buffer)) {
+            length = sizeof(buffer);
+        }
+        memcpy(buffer, ring->data + offset, length);
+        // Check the copy against overwrites that started during it
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        reserved = __atomic_load_n(&ring->reserved, __ATOMIC_RELAXED);
+        if (reserved - cursor->position > ring->capacity) {
+            continue;
+        }
+
+        const char *data = buffer;
+        if (cursor->resync) {
+            char *newline = memchr(buffer, '\n', length);
+            size_t skipped = newline != NULL ? (size_t)(newline - buffer) + 1 : length;
+            cursor->dropped += skipped;
+            cursor->position += skipped;
+            cursor->resync = (newline == NULL);
+            data += skipped;
+            length -= skipped;
+        }
+        if (length > 0 && cursor->dropped > 0) {
+            reportDroppedOutput(cursor);
+        }
+        if (length > 0) {
+            cursor->midLine = (data[length - 1] != '\n');
+        }
+        while (length > 0) {
+            ssize_t result = write(STDOUT_FILENO, data, length);
+            if (result <= 0) {
+                if (result < 0 && errno == EINTR && !interrupt_requested) {
+                    continue;
+                }
+                return;
+            }
+            data += result;
+            length -= result;
+            cursor->position += result;
+        }
+    }
+}
+
+// Function to process the "capture" builtin
+// Parameters:
+// - input: "capture" to show the setting, "capture on", "capture off" or "capture size N"
+// Example:
+//   processCaptureBuiltin("capture size 1M")
+void processCaptureBuiltin(char input[]) {
+    strtok(input, " ");
+    char *option = strtok(NULL, " ");
+    char *value = strtok(NULL, " ");
+    if (strtok(NULL, " ") != NULL) {
+        printf("Usage: capture [on|off|size N[K|M]]\n");
+        last_exit_status = 2;
+        return;
+    }
+
+    if (option == NULL) {
+        printf("capture %s, %lld bytes per job\n", output_capture_enabled ? "on" : "off", output_capture_limit);
+    } else if (strcmp(option, "on") == 0 && value == NULL) {
+        output_capture_enabled = 1;
+    } else if (strcmp(option, "off") == 0 && value == NULL) {
+        output_capture_enabled = 0;
+    } else if (strcmp(option, "size") == 0 && value != NULL) {
+        long long limit = parseByteSize(value);
+        if (limit < 1024 || limit > MAX_CAPTURE_LIMIT) {
+            printf("Error: Capture size must be between 1K and %lldM\n", MAX_CAPTURE_LIMIT / (1024 * 1024));
+            last_exit_status = 1;
+            return;
+        }
+        // Applies to jobs started from now on
+        output_capture_limit = limit;
+    } else {
+        printf("Usage: capture [on|off|size N[K|M]]\n");
+        last_exit_status = 2;
+    }
+}
+
+// Function to process the "output" builtin
+// Dumps the output captured from a background job, or with -f keeps
+// following it until the job closes its output or Ctrl-C is pressed.
+// Parameters:
+// - input: "output [-f] [%n]", the most recently captured job without %n
+// Example:
+//   processOutputBuiltin("output -f %2")
+void processOutputBuiltin(char input[]) {
+    strtok(input, " ");
+    char *spec = strtok(NULL, " ");
+    int follow = 0;
+    if (spec != NULL && strcmp(spec, "-f") == 0) {
+        follow = 1;
+        spec = strtok(NULL, " ");
+    }
+    if (strtok(NULL, " ") != NULL) {
+        printf("Usage: output [-f] [%%n]\n");
+        last_exit_status = 2;
+        return;
+    }
+
+    struct CapturedOutput *capture = NULL;
+    if (spec != NULL) {
+        char *end;
+        long id = strtol(spec[0] == '%' ? spec + 1 : spec, &end, 10);
+        if (*end != '\0' || id < 1 || id > MAX_JOBS || captured_outputs[id - 1].id == 0) {
+            printf("Error: No captured output for job %s\n", spec);
+            last_exit_status = 1;
+            return;
+        }
+        capture = &captured_outputs[id - 1];
+    } else {
+        for (int i = 0; i < MAX_JOBS; i++) {
+            if (captured_outputs[i].id != 0 && (capture == NULL || captured_outputs[i].sequence > capture->sequence)) {
+                capture = &captured_outputs[i];
+            }
+        }
+        if (capture == NULL) {
+            printf("Error: No captured output, enable it with \"capture on\"\n");
+            last_exit_status = 1;
+            return;
+        }
+    }
+
+    struct CaptureCursor cursor;
+    memset(&cursor, 0, sizeof(cursor));
+    writeCapturedOutput(capture->ring, &cursor);
+    if (!follow) {
+        return;
+    }
+
+    struct sigaction previousAction;
+    catchInterrupts(&previousAction);
+    while (!interrupt_requested && !__atomic_load_n(&capture->ring->closed, __ATOMIC_ACQUIRE)) {
+        usleep(100000);
+        writeCapturedOutput(capture->ring, &cursor);
+    }
+    // Bytes written just before the job closed its output
+    if (!interrupt_requested) {
+        writeCapturedOutput(capture->ring, &cursor);
+    }
+    sigaction(SIGINT, &previousAction, NULL);
+}
+
+// Maximum number of processes the job monitor follows at once
+#define MAX_MONITORED_PROCESSES 256
+
+// Open /proc files of a process followed by the job monitor
+// The files stay open between samples and are re-read with pread, so a
+// sample costs a few reads per process instead of opens and closes.
+struct MonitoredProcess {
+    pid_t pid;
+    int statFd;
+    int statusFd;
+    int ioFd;
+    int childrenFd;
+    unsigned long long lastTicks;   // utime + stime at the previous sample, ULLONG_MAX before one
+    int seen;                       // Found in the current sample
+};
+
+struct MonitoredProcess monitored_processes[MAX_MONITORED_PROCESSES];
+int monitored_count = 0;
+
+// Totals of one job for one sample of the job monitor
+struct JobSample {
+    int numProcesses;
+    unsigned long long ticks;       // CPU ticks used since the previous sample
+    long long rssKb;
+    long long readBytes;
+    long long writeBytes;
+};
+
+// Function to open a /proc file of a process, -1 if it cannot be opened
+int openProcFile(pid_t pid, const char *name) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+// Function to re-read an open /proc file from the start
+// Returns:
+//  Number of bytes read, -1 once the process is gone
+ssize_t readProcFile(int fd, char buffer[], size_t size) {
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t length = pread(fd, buffer, size - 1, 0);
+    if (length < 0) {
+        return -1;
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+// Function to close the /proc files of a followed process and forget it
+void forgetMonitoredProcess(int index) {
+    struct MonitoredProcess *process = &monitored_processes[index];
+    close(process->statFd);
+    if (process->statusFd != -1) {
+        close(process->statusFd);
+    }
+    if (process->ioFd != -1) {
+        close(process->ioFd);
+    }
+    if (process->childrenFd != -1) {
+        close(process->childrenFd);
+    }
+    monitored_processes[index] = monitored_processes[--monitored_count];
+}
+
+// Function to sample one process and, recursively, its descendants
+// Parameters:
+// - pid: The process
+// - sample: Totals of the job, updated
+// - depth: Recursion depth, descendants deeper than 16 levels are ignored
+void sampleProcessTree(pid_t pid, struct JobSample *sample, int depth) {
+    struct MonitoredProcess *process = NULL;
+    for (int i = 0; i < monitored_count; i++) {
+        if (monitored_processes[i].pid == pid) {
+            process = &monitored_processes[i];
+            break;
+        }
+    }
+
+    // Open the files of a process seen for the first time
+    if (process == NULL) {
+        if (monitored_count == MAX_MONITORED_PROCESSES) {
+            return;
+        }
+        int statFd = openProcFile(pid, "stat");
+        if (statFd == -1) {
+            return;
+        }
+        process = &monitored_processes[monitored_count++];
+        process->pid = pid;
+        process->statFd = statFd;
+        process->statusFd = openProcFile(pid, "status");
+        process->ioFd = openProcFile(pid, "io");
+        char childrenName[64];
+        snprintf(childrenName, sizeof(childrenName), "task/%d/children", pid);
+        process->childrenFd = openProcFile(pid, childrenName);
+        // No CPU time to compare with until the next sample
+        process->lastTicks = ULLONG_MAX;
+        process->seen = 0;
+    }
+    if (process->seen) {
+        return;
+    }
+
+    char buffer[4096];
+    // utime and stime are the 12th and 13th fields after the command name
+    if (readProcFile(process->statFd, buffer, sizeof(buffer)) <= 0) {
+        return;
+    }
+    char *fields = strrchr(buffer, ')');
+    unsigned long long userTicks = 0, systemTicks = 0;
+    if (fields == NULL || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                                 &userTicks, &systemTicks) != 2) {
+        return;
+    }
+    process->seen = 1;
+    sample->numProcesses++;
+    unsigned long long ticks = userTicks + systemTicks;
+    sample->ticks += ticks - (process->lastTicks <= ticks ? process->lastTicks : ticks);
+    process->lastTicks = ticks;
+
+    if (readProcFile(process->statusFd, buffer, sizeof(buffer)) > 0) {
+        char *rss = strstr(buffer, "VmRSS:");
+        if (rss != NULL) {
+            sample->rssKb += strtoll(rss + 6, NULL, 10);
+        }
+    }
+    if (readProcFile(process->ioFd, buffer, sizeof(buffer)) > 0) {
+        char *readBytes = strstr(buffer, "\nread_bytes:");
+        char *writeBytes = strstr(buffer, "\nwrite_bytes:");
+        if (readBytes != NULL) {
+            sample->readBytes += strtoll(readBytes + 12, NULL, 10);
+        }
+        if (writeBytes != NULL) {
+            sample->writeBytes += strtoll(writeBytes + 13, NULL, 10);
+        }
+    }
+
+    // Follow the children listed by the kernel
+    if (depth < 16 && readProcFile(process->childrenFd, buffer, sizeof(buffer)) > 0) {
+        char *cursor = buffer;
+        char *end;
+        long child;
+        while ((child = strtol(cursor, &end, 10)) > 0) {
+            sampleProcessTree(child, sample, depth + 1);
+            cursor = end;
+        }
+    }
+}
+
+// Function to format a byte count with a K, M or G suffix
+void formatBytes(long long bytes, char buffer[], size_t size) {
+    const char *units[] = {"B", "K", "M", "G", "T"};
+    double value = bytes;
+    int unit = 0;
+    while (value >= 1024 && unit < 4) {
+        value /= 1024;
+        unit++;
+    }
+    snprintf(buffer, size, unit == 0 ? "%.0f%s" : "%.1f%s", value, units[unit]);
+}
+
+// Function to process "jobs -m", a live resource view of the jobs
+// Shows CPU%, RSS, bytes read and written and elapsed time of every job,
+// including the descendants of its processes, refreshed every interval
+// until Ctrl-C, until every job has finished or after the given number of samples.
+// Parameters:
+// - input: "jobs -m [interval seconds] [samples]"
+// Example:
+//   processJobMonitor("jobs -m 0.5")
+void processJobMonitor(char input[]) {
+    strtok(input, " ");
+    strtok(NULL, " ");
+    char *intervalArg = strtok(NULL, " ");
+    char *samplesArg = strtok(NULL, " ");
+    double interval = intervalArg ? atof(intervalArg) : 1.0;
+    long maxSamples = samplesArg ? atol(samplesArg) : 0;
+    if (interval < 0.1 || strtok(NULL, " ") != NULL) {
+        printf("Usage: jobs -m [interval seconds >= 0.1] [samples]\n");
+        last_exit_status = 2;
+        return;
+    }
+
+    int clearScreen = isatty(STDOUT_FILENO);
+    long ticksPerSecond = sysconf(_SC_CLK_TCK);
+    long long lastSample = monotonicMicroseconds();
+    struct sigaction previousAction;
+    catchInterrupts(&previousAction);
+
+    for (long sampleNumber = 0; !interrupt_requested && (maxSamples == 0 || sampleNumber < maxSamples); sampleNumber++) {
+        long long now = monotonicMicroseconds();
+        double elapsedSeconds = (now - lastSample) / 1e6;
+        lastSample = now;
+
+        if (clearScreen) {
+            printf("\033[H\033[2J");
+        }
+        // Jobs that finished since the previous sample are reported above the table
+        updateJobStatuses(1);
+        printf("%-5s %5s %6s %8s %8s %8s %9s %-8s %s\n",
+               "JOB", "PROCS", "CPU%", "RSS", "READ", "WRITE", "ELAPSED", "STATE", "COMMAND");
+
+        for (int i = 0; i < monitored_count; i++) {
+            monitored_processes[i].seen = 0;
+        }
+        int numJobs = 0;
+        for (int i = 0; i < MAX_JOBS; i++) {
+            struct Job *job = &jobs[i];
+            if (job->id == 0) {
+                continue;
+            }
+            numJobs++;
+            struct JobSample sample;
+            memset(&sample, 0, sizeof(sample));
+            for (int j = 0; j < job->numProcesses; j++) {
+                // The shell's own fan-out and capture helpers are not the job's work
+                if (job->processes[j].state != JOB_DONE && !job->processes[j].helper) {
+                    sampleProcessTree(job->processes[j].pid, &sample, 0);
+                }
+            }
+
+            // The first sample has no previous CPU time to compare with
+            double cpuPercent = (sampleNumber > 0 && elapsedSeconds > 0)
+                                ? 100.0 * sample.ticks / ticksPerSecond / elapsedSeconds : 0.0;
+            char rss[16], readBytes[16], writeBytes[16];
+            formatBytes(sample.rssKb * 1024, rss, sizeof(rss));
+            formatBytes(sample.readBytes, readBytes, sizeof(readBytes));
+            formatBytes(sample.writeBytes, writeBytes, sizeof(writeBytes));
+            long long elapsed = (now - job->startTime) / 1000000;
+            char elapsedText[32];
+            snprintf(elapsedText, sizeof(elapsedText), "%lld:%02lld:%02lld", elapsed / 3600, elapsed / 60 % 60, elapsed % 60);
+            const char *stateNames[] = {"Running", "Stopped", "Done"};
+            char jobId[16];
+            snprintf(jobId, sizeof(jobId), "[%d]", job->id);
+            printf("%-5s %5d %6.1f %8s %8s %8s %9s %-8s %s\n", jobId, sample.numProcesses, cpuPercent,
+                   rss, readBytes, writeBytes, elapsedText, stateNames[job->state], job->command);
+        }
+
+        // Close the files of processes that have exited
+        for (int i = monitored_count - 1; i >= 0; i--) {
+            if (!monitored_processes[i].seen) {
+                forgetMonitoredProcess(i);
+            }
+        }
+
+        fflush(stdout);
+        if (numJobs == 0) {
+            printf("No jobs\n");
+            break;
+        }
+        if (maxSamples != 0 && sampleNumber == maxSamples - 1) {
+            break;
+        }
+        // Interrupted early by Ctrl-C
+        usleep((useconds_t)(interval * 1e6));
+    }
+
+    while (monitored_count > 0) {
+        forgetMonitoredProcess(monitored_count - 1);
+    }
+    sigaction(SIGINT, &previousAction, NULL);
+}
+
+// Function to process the "set" builtin for shell options
+// Parameters:
+// - input: "set" to show the options, "set -e", "set +e", "set -o pipefail" or "set +o pipefail"
+// Example:
+//   processSetBuiltin("set -o pipefail")
+void processSetBuiltin(char input[]) {
+    strtok(input, " ");
+    char *flag = strtok(NULL, " ");
+    char *option = strtok(NULL, " ");
+    if (strtok(NULL, " ") != NULL) {
+        printf("Usage: set [-e|+e] [-o|+o pipefail]\n");
+        last_exit_status = 2;
+        return;
+    }
+
+    if (flag == NULL) {
+        printf("set %ce\n", errexit_enabled ? '-' : '+');
+        printf("set %co pipefail\n", pipefail_enabled ? '-' : '+');
+    } else if ((strcmp(flag, "-e") == 0 || strcmp(flag, "+e") == 0) && option == NULL) {
+        errexit_enabled = (flag[0] == '-');
+    } else if ((strcmp(flag, "-o") == 0 || strcmp(flag, "+o") == 0) && option != NULL && strcmp(option, "pipefail") == 0) {
+        pipefail_enabled = (flag[0] == '-');
+    } else {
+        printf("Usage: set [-e|+e] [-o|+o pipefail]\n");
+        last_exit_status = 2;
+    }
+}
+
+// Types of command lines as identified by executeCommandLine
+enum CommandType {
+    COMMAND_NONE = -1, // Empty or invalid command line
+    COMMAND_NORMAL,
+    COMMAND_PIPE,
+    COMMAND_REDIRECT,
+    COMMAND_AND_OR,
+    COMMAND_SEQUENTIAL,
+    COMMAND_BACKGROUND,
+    COMMAND_CONCATENATE,
+    COMMAND_BUILTIN,
+    NUM_COMMAND_TYPES
+};
+
+// Names of the command types, indexed by enum CommandType
+const char *command_type_names[NUM_COMMAND_TYPES] = {
+    "normal", "pipe", "redirect", "and-or", "sequential", "background", "concat", "builtin"
+};
+
+// Function to identify the type of a command line and execute it
+// Parameters:
+// - input: The command line without its trailing newline
+// Returns:
+//  The type of the command line (enum CommandType)
+// Example:
+//   executeCommandLine("ls -l | wc") returns COMMAND_PIPE
+int executeCommandLine(char input[]) {
+    // Flags to identify the type of command
+    int concatenate = 0; // File concatenation
+    int piping = 0;  // Pipe operation
+    int redirect = 0; // Input/Ouput redirection
+    int and_or=0; // && and || 
+    int sequential=0; // ; Sequential execution
+    int backgroundProcess=0; // Execute in background
+
+    // Traverse through input
+    for (int i = 0; i < strlen(input); i++) {
+        if (input[i] == '|') {
+            // if double '|' then it is OR
+            if(i+1<strlen(input) && input[i+1]=='|'){
+                and_or=1;
+            }else if(i-1>0 && input[i-1]=='|'){
+                and_or=1; 
+            }else{
+                // Single '|' means pipe
+                piping = 1;
+            }
+        } else if (input[i] == '#') {
+            // # means file concatenation
+            concatenate = 1;
+        } else if (input[i] == '>' || input[i] == '<') {
+            // if > or < or >> it means input/output redirection
+            redirect = 1;
+        } else if(input[i]=='&'){
+            // Double '&' means AND
+             if(i+1<strlen(input) && input[i+1]=='&'){
+                and_or=1;
+            }else if(i-1>0 && input[i-1]=='&'){
+                and_or=1; 
+            }else{
+                // Single '&' means run in background
+                backgroundProcess = 1;
+            }
+        }else if(input[i]==';'){
+            // ; means run sequentially
+            sequential=1;
+        }
+    }
+
+    // Type of the command line, reported to the caller
+    int commandType = COMMAND_BUILTIN;
+
+    // Builtins succeed unless they report an error, and set the status themselves
+    // if newt it means open a new shell
+    if(strcmp("newt",input)==0){
+        last_exit_status = 0;
+        startNewShell();
+    }
+    // shell options: set -e and set -o pipefail
+    else if(strncmp("set ",input,4)==0 || strcmp("set",input)==0){
+        last_exit_status = 0;
+        processSetBuiltin(input);
+    }
+    // live resource view of the jobs
+    else if(strcmp("jobs -m",input)==0 || strncmp("jobs -m ",input,8)==0){
+        last_exit_status = 0;
+        processJobMonitor(input);
+    }
+    // job control: jobs, fg, bg, kill %n and stop %n
+    else if(isJobBuiltin(input)){
+        last_exit_status = 0;
+        processJobBuiltin(input);
+    }
+    // run a file's command lines in this shell
+    else if(strncmp("source ",input,7)==0 || strncmp(". ",input,2)==0){
+        processSourceBuiltin(input);
+    }
+    // re-run a command whenever its input files change
+    else if(strncmp("watch ",input,6)==0){
+        last_exit_status = 0;
+        processWatchBuiltin(input);
+    }
+    // report arena and process memory usage
+    else if(strcmp("memstats",input)==0){
+        last_exit_status = 0;
+        printMemoryStats();
+    }
+    // background job output capture
+    else if(strncmp("capture ",input,8)==0 || strcmp("capture",input)==0){
+        last_exit_status = 0;
+        processCaptureBuiltin(input);
+    }
+    else if(strncmp("output ",input,7)==0 || strcmp("output",input)==0){
+        last_exit_status = 0;
+        processOutputBuiltin(input);
+    }
+    // run a command through the output cache
+    else if(strncmp("cached ",input,7)==0){
+        processCachedCommand(input+7);
+    }
+    else if(strncmp("cache ",input,6)==0 || strcmp("cache",input)==0){
+        last_exit_status = 0;
+        processCacheBuiltin(input);
+    }
+    // Execute functions based on their type of input
+    else if(concatenate==1){
+        commandType = COMMAND_CONCATENATE;
+        processFileConcatenation(input);
+    }else if(piping==1){
+        commandType = COMMAND_PIPE;
+        processPipeOperation(input);
+    }else if(redirect==1){
+        commandType = COMMAND_REDIRECT;
+        processRedirection(input);
+    }else if(and_or==1){
+        commandType = COMMAND_AND_OR;
+        processAndOr(input);
+    }else if(sequential==1){
+        commandType = COMMAND_SEQUENTIAL;
+        processSequentialCommands(input);
+    }else if(backgroundProcess==1){
+        commandType = COMMAND_BACKGROUND;
+        processBackgroundExecution(input);
+    }
+    else{
+        commandType = COMMAND_NORMAL;
+        processNormalCommand(input);
+    }
+    return commandType;
+}
+
+// Maximum number of <(...) and >(...) substitutions in one command line
+#define MAX_PROCESS_SUBSTITUTIONS 4
+
+// Function to close the shell's pipe ends and wait for the inner commands
+// Parameters:
+// - pids: Process IDs of the inner commands
+// - fds: Pipe ends kept open by the shell
+// - count: Number of substitutions
+void closeProcessSubstitutions(pid_t pids[], int fds[], int count) {
+    // Closing first lets >(cmd) readers see EOF and <(cmd) writers stop
+    for (int i = 0; i < count; i++) {
+        close(fds[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        waitForegroundProcess(pids[i], NULL, 0);
+    }
+}
+
+// Function to close the shell's pipe ends without waiting for the inner commands
+// Used when the outer command runs in the background; the inner commands are
+// reaped once they exit, or waited for if too many are already left running.
+// Parameters:
+// - pids: Process IDs of the inner commands
+// - fds: Pipe ends kept open by the shell
+// - count: Number of substitutions
+void detachProcessSubstitutions(pid_t pids[], int fds[], int count) {
+    for (int i = 0; i < count; i++) {
+        close(fds[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        if (detached_count < MAX_DETACHED_PROCESSES) {
+            detached_processes[detached_count++] = pids[i];
+        } else {
+            waitForegroundProcess(pids[i], NULL, 0);
+        }
+    }
+}
+
+// Function to replace <(cmd) and >(cmd) with /dev/fd/N paths
+// Each inner command is started right away connected to a pipe; the shell
+// keeps the other end of the pipe open (without close-on-exec) so that the
+// outer command inherits it and can open it through /dev/fd/N. Both commands
+// run concurrently and the data never touches the disk.
+// Parameters:
+// - input: The command line containing substitutions
+// - output: Buffer receiving the rewritten command line
+// - outputSize: Size of the output buffer
+// - pids: Filled with the process IDs of the inner commands
+// - fds: Filled with the pipe ends kept open by the shell
+// Returns:
+//  Number of substitutions started, -1 on error
+// Example:
+//   "diff <(ls dir1) <(ls dir2)" becomes "diff /dev/fd/3 /dev/fd/4"
+int expandProcessSubstitutions(char input[], char output[], size_t outputSize, pid_t pids[], int fds[]) {
+    int count = 0;
+    size_t used = 0;
+
+    for (int i = 0; input[i] != '\0'; i++) {
+        if ((input[i] != '<' && input[i] != '>') || input[i + 1] != '(') {
+            if (used + 1 >= outputSize) {
+                printf("Error: Command too long after process substitution\n");
+                closeProcessSubstitutions(pids, fds, count);
+                return -1;
+            }
+            output[used++] = input[i];
+            continue;
+        }
+
+        // Find the matching closing bracket
+        int readsOutput = (input[i] == '<');
+        int start = i + 2;
+        int end = start;
+        int depth = 1;
+        while (input[end] != '\0') {
+            if (input[end] == '(') {
+                depth++;
+            } else if (input[end] == ')' && --depth == 0) {
+                break;
+            }
+            end++;
+        }
+        if (input[end] == '\0') {
+            printf("Error: Missing ')' in process substitution\n");
+            closeProcessSubstitutions(pids, fds, count);
+            return -1;
+        }
+        if (count == MAX_PROCESS_SUBSTITUTIONS) {
+            printf("Error: Too many process substitutions (up to %d allowed)\n", MAX_PROCESS_SUBSTITUTIONS);
+            closeProcessSubstitutions(pids, fds, count);
+            return -1;
+        }
+
+        char innerCommand[MAX_COMMAND_LENGTH];
+        snprintf(innerCommand, sizeof(innerCommand), "%.*s", end - start, input + start);
+        trimWhitespace(innerCommand);
+
+        int pipeFds[2];
+        if (pipe(pipeFds) == -1) {
+            perror("Pipe creation failed");
+            closeProcessSubstitutions(pids, fds, count);
+            return -1;
+        }
+
+        // <(cmd): cmd writes, outer command reads
+        // >(cmd): outer command writes, cmd reads
+        int innerEnd = readsOutput ? pipeFds[1] : pipeFds[0];
+        int shellEnd = readsOutput ? pipeFds[0] : pipeFds[1];
+
+        int pid = forkJobProcess(NULL);
+        if (pid < 0) {
+            perror("Fork failed");
+            close(pipeFds[0]);
+            close(pipeFds[1]);
+            closeProcessSubstitutions(pids, fds, count);
+            return -1;
+        }
+        if (pid == 0) {
+            // Child process runs the inner command line
+            // Drop the ends of earlier substitutions so their readers see EOF
+            for (int j = 0; j < count; j++) {
+                close(fds[j]);
+            }
+            close(shellEnd);
+            if (dup2(innerEnd, readsOutput ? STDOUT_FILENO : STDIN_FILENO) == -1) {
+                perror("Dup2 failed");
+                exitChild(EXIT_FAILURE);
+            }
+            close(innerEnd);
+            processCommandLine(innerCommand);
+            exitChild(last_exit_status);
+        }
+
+        close(innerEnd);
+        pids[count] = pid;
+        fds[count] = shellEnd;
+        count++;
+
+        // Replace the substitution by the path of the shell's pipe end
+        int written = snprintf(output + used, outputSize - used, "/dev/fd/%d", shellEnd);
+        if (written < 0 || used + written >= outputSize) {
+            printf("Error: Command too long after process substitution\n");
+            closeProcessSubstitutions(pids, fds, count);
+            return -1;
+        }
+        used += written;
+        i = end;
+    }
+
+    output[used] = '\0';
+    return count;
+}
+
+// Function to process one command line entered at the prompt
+// Process substitutions are started first and cleaned up once the
+// command line has finished.
+// Parameters:
+// - input: The command line without its trailing newline
+// Returns:
+//  The type of the command line (enum CommandType)
+int processCommandLine(char input[]) {
+    // Ignore empty command lines
+    trimWhitespace(input);
+    if (input[0] == '\0') {
+        return COMMAND_NONE;
+    }
+
+    // Only a && or || list can make set -e overlook its failure
+    errexit_ignored = 0;
+
+    // Jobs started by this command line are named after it
+    snprintf(current_command_line, sizeof(current_command_line), "%s", input);
+
+    if (strstr(input, "<(") == NULL && strstr(input, ">(") == NULL) {
+        return executeCommandLine(input);
+    }
+
+    // Substituted paths can be longer than the text they replace
+    char expandedInput[2 * MAX_COMMAND_LENGTH];
+    pid_t pids[MAX_PROCESS_SUBSTITUTIONS];
+    int fds[MAX_PROCESS_SUBSTITUTIONS];
+    int count = expandProcessSubstitutions(input, expandedInput, sizeof(expandedInput), pids, fds);
+    if (count == -1) {
+        last_exit_status = 2;
+        return COMMAND_NONE;
+    }
+
+    int commandType = executeCommandLine(expandedInput);
+    if (commandType == COMMAND_BACKGROUND) {
+        detachProcessSubstitutions(pids, fds, count);
+    } else {
+        closeProcessSubstitutions(pids, fds, count);
+    }
+    return commandType;
+}
+
+// Function to append one command line to a session recording
+// Each line of a recording is "<type>\t<latency us>\t<exit status>\t<command>".
+// Parameters:
+// - recordFile: The open recording
+// - commandType: Type returned by processCommandLine
+// - latency: Time the command line took in microseconds
+// - command: The command line as entered
+void recordCommandLine(FILE *recordFile, int commandType, long long latency, char command[]) {
+    if (commandType == COMMAND_NONE) {
+        return;
+    }
+    fprintf(recordFile, "%s\t%lld\t%d\t%s\n", command_type_names[commandType], latency, last_exit_status, command);
+    fflush(recordFile);
+}
+
+// Latencies of the replayed command lines of one type
+struct LatencySamples {
+    long long *values;
+    int count;
+    int capacity;
+};
+
+// Function to order latencies for percentile computation
+int compareLatencies(const void *a, const void *b) {
+    long long first = *(const long long *)a;
+    long long second = *(const long long *)b;
+    return (first > second) - (first < second);
+}
+
+// Function to get a percentile of sorted latencies (nearest rank)
+// Parameters:
+// - samples: Sorted latencies
+// - percentile: Percentile between 0 and 100
+long long latencyPercentile(struct LatencySamples *samples, double percentile) {
+    int rank = (int)(percentile / 100.0 * samples->count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    return samples->values[rank - 1];
+}
+
+// Function to read the p50/p90/p99 latencies of a stored baseline
+// Each line of a baseline is "<type> <count> <p50 us> <p90 us> <p99 us>".
+// Parameters:
+// - baselineFile: Path of the baseline
+// - baseline: Filled with the percentiles indexed by command type, -1 if absent
+// Returns:
+//  0 on success, -1 if the baseline could not be read
+int readLatencyBaseline(char *baselineFile, long long baseline[][3]) {
+    for (int i = 0; i < NUM_COMMAND_TYPES; i++) {
+        baseline[i][0] = baseline[i][1] = baseline[i][2] = -1;
+    }
+
+    FILE *file = fopen(baselineFile, "r");
+    if (file == NULL) {
+        perror("Error opening baseline");
+        return -1;
+    }
+    char typeName[32];
+    int count;
+    long long p50, p90, p99;
+    while (fscanf(file, "%31s %d %lld %lld %lld", typeName, &count, &p50, &p90, &p99) == 5) {
+        for (int i = 0; i < NUM_COMMAND_TYPES; i++) {
+            if (strcmp(typeName, command_type_names[i]) == 0) {
+                baseline[i][0] = p50;
+                baseline[i][1] = p90;
+                baseline[i][2] = p99;
+            }
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+// Function to replay a recorded session and report latency percentiles
+// Command lines are run one after the other through processCommandLine
+// without a prompt. The report goes to stderr so that command output can
+// be discarded.
+// Parameters:
+// - sessionFile: Recording made with --record
+// - baselineFile: Baseline to compare against, NULL for none
+// - saveBaselineFile: Where to store this run as a baseline, NULL for none
+// - threshold: Percentage by which p50 or p90 may grow before it is a regression
+// Returns:
+//  0 if there is no regression, 1 otherwise
+// Example:
+//   shell24 --replay session.log --baseline base.txt > /dev/null
+int replaySession(char *sessionFile, char *baselineFile, char *saveBaselineFile, double threshold) {
+    FILE *file = fopen(sessionFile, "r");
+    if (file == NULL) {
+        perror("Error opening session");
+        return 1;
+    }
+
+    // Load the whole recording first, so that nothing the replayed commands
+    // do can move the file offset under the reader
+    char *contents = NULL;
+    size_t contentsCapacity = 0;
+    if (getdelim(&contents, &contentsCapacity, '\0', file) == -1 && ferror(file)) {
+        perror("Error reading session");
+        free(contents);
+        fclose(file);
+        return 1;
+    }
+    fclose(file);
+
+    struct LatencySamples samples[NUM_COMMAND_TYPES];
+    memset(samples, 0, sizeof(samples));
+
+    char *nextLine = contents;
+    int lineNumber = 0;
+    // Set when set -e ends the replay early
+    int stopped = 0;
+    while (!stopped && nextLine != NULL && *nextLine != '\0') {
+        char *line = nextLine;
+        nextLine = strchr(line, '\n');
+        if (nextLine != NULL) {
+            *nextLine++ = '\0';
+        }
+        lineNumber++;
+
+        // Skip the recorded type, latency and exit status
+        char *command = line;
+        for (int field = 0; field < 3 && command != NULL; field++) {
+            command = strchr(command, '\t');
+            if (command != NULL) {
+                command++;
+            }
+        }
+        if (command == NULL) {
+            fprintf(stderr, "Skipping malformed line %d of %s\n", lineNumber, sessionFile);
+            continue;
+        }
+
+        char input[MAX_COMMAND_LENGTH];
+        strncpy(input, command, sizeof(input) - 1);
+        input[sizeof(input) - 1] = '\0';
+
+        long long start = monotonicMicroseconds();
+        int commandType = processCommandLine(input);
+        long long latency = monotonicMicroseconds() - start;
+        fflush(stdout);
+        arenaReset();
+
+        if (failureStopsShell()) {
+            fprintf(stderr, "Stopped by set -e at line %d of %s with status %d\n", lineNumber, sessionFile, last_exit_status);
+            stopped = 1;
+        }
+        if (commandType == COMMAND_NONE) {
+            continue;
+        }
+        struct LatencySamples *typeSamples = &samples[commandType];
+        if (typeSamples->count == typeSamples->capacity) {
+            int capacity = typeSamples->capacity ? 2 * typeSamples->capacity : 64;
+            long long *grown = realloc(typeSamples->values, capacity * sizeof(long long));
+            if (grown == NULL) {
+                perror("Memory allocation failed");
+                break;
+            }
+            typeSamples->values = grown;
+            typeSamples->capacity = capacity;
+        }
+        typeSamples->values[typeSamples->count++] = latency;
+    }
+    free(contents);
+
+    long long baseline[NUM_COMMAND_TYPES][3];
+    int haveBaseline = (baselineFile != NULL && readLatencyBaseline(baselineFile, baseline) == 0);
+    FILE *saveFile = NULL;
+    if (saveBaselineFile != NULL && (saveFile = fopen(saveBaselineFile, "w")) == NULL) {
+        perror("Error creating baseline");
+    }
+
+    int regressions = 0;
+    fprintf(stderr, "%-12s %7s %12s %12s %12s\n", "type", "count", "p50 (us)", "p90 (us)", "p99 (us)");
+    for (int i = 0; i < NUM_COMMAND_TYPES; i++) {
+        if (samples[i].count == 0) {
+            continue;
+        }
+        qsort(samples[i].values, samples[i].count, sizeof(long long), compareLatencies);
+        long long current[3] = {
+            latencyPercentile(&samples[i], 50),
+            latencyPercentile(&samples[i], 90),
+            latencyPercentile(&samples[i], 99)
+        };
+        fprintf(stderr, "%-12s %7d %12lld %12lld %12lld\n", command_type_names[i], samples[i].count,
+                current[0], current[1], current[2]);
+
+        if (haveBaseline && baseline[i][0] >= 0) {
+            // Changes relative to the baseline; p99 is shown but too noisy to fail on
+            double change[3];
+            for (int j = 0; j < 3; j++) {
+                change[j] = baseline[i][j] > 0 ? 100.0 * (current[j] - baseline[i][j]) / baseline[i][j] : 0.0;
+            }
+            int regressed = (change[0] > threshold || change[1] > threshold);
+            regressions += regressed;
+            fprintf(stderr, "%-12s %7s %+11.1f%% %+11.1f%% %+11.1f%%%s\n", "  vs base", "",
+                    change[0], change[1], change[2], regressed ? "  REGRESSION" : "");
+        }
+        if (saveFile != NULL) {
+            fprintf(saveFile, "%s %d %lld %lld %lld\n", command_type_names[i], samples[i].count,
+                    current[0], current[1], current[2]);
+        }
+        free(samples[i].values);
+    }
+    if (saveFile != NULL) {
+        fclose(saveFile);
+    }
+
+    if (regressions > 0) {
+        fprintf(stderr, "%d command type(s) regressed by more than %.1f%%\n", regressions, threshold);
+        return 1;
+    }
+    return stopped ? last_exit_status : 0;
+}
+
+// Default number of clients served at the same time by --serve
+#define DEFAULT_MAX_CLIENTS 4
+// Maximum length of a command line frame sent to --serve
+#define MAX_FRAME_LENGTH 4096
+
+// Function to read exactly length bytes from a socket
+// Returns:
+//  0 on success, -1 on end of file or error
+int readFrameBytes(int fd, void *buffer, size_t length) {
+    char *data = buffer;
+    while (length > 0) {
+        ssize_t received = read(fd, data, length);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return -1;
+        }
+        data += received;
+        length -= received;
+    }
+    return 0;
+}
+
+// Function to receive the header of a command line frame
+// The header is the 4-byte length of the command line in network byte order.
+// Its first byte may carry the client's stdin, stdout and stderr as SCM_RIGHTS
+// ancillary data; those then replace the connection's standard descriptors.
+// Parameters:
+// - socketFd: The client connection
+// - length: Filled with the length of the command line
+// Returns:
+//  Number of descriptors received, -1 on end of file or error
+int receiveFrameHeader(int socketFd, uint32_t *length) {
+    uint32_t header;
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec iov = { .iov_base = &header, .iov_len = sizeof(header) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do {
+        received = recvmsg(socketFd, &message, MSG_CMSG_CLOEXEC);
+    } while (received == -1 && errno == EINTR);
+    if (received <= 0) {
+        return -1;
+    }
+
+    int fds[3];
+    int numFds = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && numFds == 0) {
+            numFds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            numFds = numFds > 3 ? 3 : numFds;
+            memcpy(fds, CMSG_DATA(cmsg), numFds * sizeof(int));
+        }
+    }
+    int failed = (received < (ssize_t)sizeof(header) &&
+                  readFrameBytes(socketFd, (char *)&header + received, sizeof(header) - received) == -1);
+
+    // Only a full set of three descriptors replaces the current ones
+    if (!failed && numFds == 3) {
+        // Flush what earlier commands printed to the previous descriptors
+        fflush(stdout);
+        fflush(stderr);
+        for (int i = 0; i < 3; i++) {
+            dup2(fds[i], i);
+        }
+    }
+    for (int i = 0; i < numFds; i++) {
+        if (fds[i] > 2) {
+            close(fds[i]);
+        }
+    }
+    if (failed) {
+        return -1;
+    }
+    *length = ntohl(header);
+    return numFds == 3 ? 3 : 0;
+}
+
+// Function to send the reply to one command line
+// The reply is a frame like the request: a 4-byte length in network byte
+// order followed by "<status> <wall us> <user us> <system us> <max rss KB>\n".
+// Parameters:
+// - maxRssKb: Largest RSS of the processes the command line waited for
+// Returns:
+//  0 on success, -1 if the client went away
+int sendFrameReply(int socketFd, int status, long long wallMicroseconds, struct rusage *before, struct rusage *after,
+                   long maxRssKb) {
+    char text[128];
+    long long userMicroseconds = (after->ru_utime.tv_sec - before->ru_utime.tv_sec) * 1000000LL +
+                                 (after->ru_utime.tv_usec - before->ru_utime.tv_usec);
+    long long systemMicroseconds = (after->ru_stime.tv_sec - before->ru_stime.tv_sec) * 1000000LL +
+                                   (after->ru_stime.tv_usec - before->ru_stime.tv_usec);
+    int length = snprintf(text, sizeof(text), "%d %lld %lld %lld %ld\n", status, wallMicroseconds,
+                          userMicroseconds, systemMicroseconds, maxRssKb);
+
+    char frame[sizeof(uint32_t) + sizeof(text)];
+    uint32_t header = htonl(length);
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), text, length);
+    size_t remaining = sizeof(header) + length;
+    char *data = frame;
+    while (remaining > 0) {
+        ssize_t sent = send(socketFd, data, remaining, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return -1;
+        }
+        data += sent;
+        remaining -= sent;
+    }
+    return 0;
+}
+
+// Function to serve one client connection, run in its own process
+// Every connection is a separate shell session: options, jobs and the
+// output cache statistics are kept between its command lines.
+// Parameters:
+// - socketFd: The client connection
+// Returns:
+//  Exit status of the last command line
+int serveClient(int socketFd) {
+    // Commands start with /dev/null until the client sends descriptors
+    int nullFd = open("/dev/null", O_RDWR);
+    if (nullFd != -1) {
+        for (int i = 0; i < 3; i++) {
+            dup2(nullFd, i);
+        }
+        if (nullFd > 2) {
+            close(nullFd);
+        }
+    }
+
+    char input[MAX_FRAME_LENGTH + 1];
+    uint32_t length;
+    while (receiveFrameHeader(socketFd, &length) != -1) {
+        if (length > MAX_FRAME_LENGTH) {
+            break;
+        }
+        if (readFrameBytes(socketFd, input, length) == -1) {
+            break;
+        }
+        input[length] = '\0';
+
+        struct rusage before, after;
+        getrusage(RUSAGE_CHILDREN, &before);
+        foreground_max_rss_kb = 0;
+        long long start = monotonicMicroseconds();
+
+        if (length >= MAX_COMMAND_LENGTH) {
+            printf("Error: Command line longer than %d characters\n", MAX_COMMAND_LENGTH - 1);
+            last_exit_status = 2;
+        } else {
+            processCommandLine(input);
+            arenaReset();
+        }
+        fflush(stdout);
+        fflush(stderr);
+        updateJobStatuses(0);
+
+        long long wall = monotonicMicroseconds() - start;
+        getrusage(RUSAGE_CHILDREN, &after);
+        if (sendFrameReply(socketFd, last_exit_status, wall, &before, &after, foreground_max_rss_kb) == -1) {
+            break;
+        }
+        // set -e ends the session at the first failure
+        if (failureStopsShell()) {
+            break;
+        }
+    }
+    close(socketFd);
+    return last_exit_status;
+}
+
+// Function to run shell24 as a daemon executing command lines sent over a Unix socket
+// Each connection is served by its own child process, at most maxClients at
+// a time; further clients wait in the listen queue. Ctrl-C or SIGTERM stops
+// accepting, waits for the connections being served and removes the socket.
+// Parameters:
+// - socketPath: Path of the socket to create
+// - maxClients: Number of connections served concurrently
+// Returns:
+//  0 after a clean shutdown, 1 if the socket could not be created
+// Example:
+//   serveCommands("/tmp/shell24.sock", 8)
+int serveCommands(char *socketPath, int maxClients) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path too long: %s\n", socketPath);
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    // Replace a socket left behind by a previous daemon, never a regular file
+    struct stat pathStat;
+    if (lstat(socketPath, &pathStat) == 0 && S_ISSOCK(pathStat.st_mode)) {
+        unlink(socketPath);
+    }
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd == -1) {
+        perror("socket");
+        return 1;
+    }
+    // Anyone who can connect can run commands as this user, so the socket
+    // is created with mode 0600
+    mode_t previousMask = umask(0177);
+    int bound = bind(listenFd, (struct sockaddr *)&address, sizeof(address));
+    umask(previousMask);
+    if (bound == -1 || listen(listenFd, 64) == -1) {
+        perror(socketPath);
+        close(listenFd);
+        return 1;
+    }
+
+    struct sigaction previousInterrupt;
+    catchInterrupts(&previousInterrupt);
+    struct sigaction action;
+    sigaction(SIGINT, NULL, &action);
+    sigaction(SIGTERM, &action, NULL);
+
+    int activeClients = 0;
+    while (!interrupt_requested) {
+        // Reap finished connections, waiting for one when all slots are busy
+        pid_t pid;
+        while (activeClients > 0 && (pid = waitpid(-1, NULL, activeClients >= maxClients ? 0 : WNOHANG)) != 0) {
+            if (pid > 0) {
+                activeClients--;
+            } else if (errno != ECHILD) {
+                break;
+            } else {
+                activeClients = 0;
+            }
+        }
+        if (interrupt_requested) {
+            break;
+        }
+
+        int clientFd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+        if (clientFd == -1) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                perror("accept");
+            }
+            continue;
+        }
+
+        pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            close(clientFd);
+            continue;
+        }
+        if (pid == 0) {
+            close(listenFd);
+            sigaction(SIGINT, &previousInterrupt, NULL);
+            signal(SIGTERM, SIG_DFL);
+            exitChild(serveClient(clientFd));
+        }
+        close(clientFd);
+        activeClients++;
+    }
+
+    close(listenFd);
+    unlink(socketPath);
+    while (activeClients > 0) {
+        if (wait(NULL) > 0) {
+            activeClients--;
+        } else if (errno != EINTR) {
+            break;
+        }
+    }
+    return 0;
+}
+
+// Function to print how to start shell24
+void printUsage(char *program) {
+    printf("Usage: %s [--record session.log]\n", program);
+    printf("       %s --replay session.log [--baseline base.txt] [--save-baseline base.txt] [--threshold percent]\n", program);
+    printf("       %s --serve /path/to/socket [--max-clients N]\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    // Session recording enabled with --record
+    FILE *recordFile = NULL;
+
+    if (argc >= 2 && strcmp(argv[1], "--replay") == 0) {
+        char *baselineFile = NULL;
+        char *saveBaselineFile = NULL;
+        double threshold = 10.0;
+        if (argc < 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+                baselineFile = argv[++i];
+            } else if (strcmp(argv[i], "--save-baseline") == 0 && i + 1 < argc) {
+                saveBaselineFile = argv[++i];
+            } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+                threshold = atof(argv[++i]);
+            } else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        return replaySession(argv[2], baselineFile, saveBaselineFile, threshold);
+    } else if (argc >= 3 && strcmp(argv[1], "--serve") == 0) {
+        int maxClients = DEFAULT_MAX_CLIENTS;
+        if (argc == 5 && strcmp(argv[3], "--max-clients") == 0 && atoi(argv[4]) > 0) {
+            maxClients = atoi(argv[4]);
+        } else if (argc != 3) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        return serveCommands(argv[2], maxClients);
+    } else if (argc == 3 && strcmp(argv[1], "--record") == 0) {
+        recordFile = fopen(argv[2], "a");
+        if (recordFile == NULL) {
+            perror("Error opening session");
+            return 1;
+        }
+    } else if (argc != 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Take over the terminal when running interactively
+    initJobControl();
+
+    // get user input in an array
+    char input[MAX_COMMAND_LENGTH];
+    // copy of the command line for the recording, processing modifies input
+    char command[MAX_COMMAND_LENGTH];
+
+    // infinite loop for shell
+    while (1) {
+        // Report background jobs that finished since the last prompt
+        updateJobStatuses(1);
+
+        // print shell prompt and wait for user input
+        printf("shell24$ ");
+        fflush(stdout);
+
+        // take user input, stop at end of input
+        if (fgets(input, sizeof(input), stdin) == NULL) {
+            printf("\n");
+            break;
+        }
+
+        // Remove trailing newline character
+        if (input[strlen(input) - 1] == '\n') {
+            input[strlen(input) - 1] = '\0';
+        }
+
+        if (recordFile != NULL) {
+            strcpy(command, input);
+            trimWhitespace(command);
+            long long start = monotonicMicroseconds();
+            int commandType = processCommandLine(input);
+            recordCommandLine(recordFile, commandType, monotonicMicroseconds() - start, command);
+        } else {
+            processCommandLine(input);
+        }
+
+        // Free everything allocated while processing the command line
+        arenaReset();
+
+        // With set -e the shell exits with the status of the failed command
+        if (failureStopsShell()) {
+            break;
+        }
+    }
+
+    if (recordFile != NULL) {
+        fclose(recordFile);
+    }
+    return failureStopsShell() ? last_exit_status : 0;
+}